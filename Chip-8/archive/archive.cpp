@@ -0,0 +1,208 @@
+#include "archive.hpp"
+#include "hash.hpp"
+#include<fstream>
+#include<cstring>
+#include<map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ARCHIVE_MMAP 1
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#else
+#define ARCHIVE_MMAP 0
+#endif
+
+namespace chip{
+    namespace{
+        const char archive_magic[8] = {'C', 'H', '8', 'R', 'O', 'M', 'S', '1'};
+        const size_t max_rom_size = 0x1000 - 0x200;
+        
+        void put(std::vector<unsigned char>& out, unsigned long long value, int bytes){
+            for(int i = 0; i < bytes; i++){
+                out.push_back((value >> (8 * i)) & 0xFF);
+            }
+        }
+        
+        unsigned long long get(const unsigned char* in, int bytes){
+            unsigned long long value = 0;
+            for(int i = 0; i < bytes; i++){
+                value |= (unsigned long long)in[i] << (8 * i);
+            }
+            return value;
+        }
+    }
+    
+    RomArchive::RomArchive(){
+        data = nullptr;
+        length = 0;
+        count = 0;
+        mapped = false;
+    }
+    
+    RomArchive::~RomArchive(){
+        close();
+    }
+    
+    bool RomArchive::open(std::string path, std::string& error){
+        close();
+
+#if ARCHIVE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            error = "archive could not be opened";
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0){
+            ::close(fd);
+            error = "archive could not be opened";
+            return false;
+        }
+        length = info.st_size;
+        if(length > 0){
+            void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map == MAP_FAILED){
+                ::close(fd);
+                length = 0;
+                error = "archive could not be mapped";
+                return false;
+            }
+            data = static_cast<const unsigned char*>(map);
+            mapped = true;
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if(!file){
+            error = "archive could not be opened";
+            return false;
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        length = buffer.size();
+#endif
+        
+        if(length < header_size || memcmp(data, archive_magic, sizeof(archive_magic)) != 0){
+            close();
+            error = "not a ROM archive";
+            return false;
+        }
+        const size_t entries = get(data + sizeof(archive_magic), 4);
+        if(entries > (length - header_size) / entry_size){
+            close();
+            error = "archive table is truncated";
+            return false;
+        }
+        
+        //everything a lookup or a load relies on is checked here, once
+        for(size_t i = 0; i < entries; i++){
+            const unsigned char* entry = data + header_size + i * entry_size;
+            const unsigned long long offset = get(entry + 8, 4);
+            const unsigned long long size = get(entry + 12, 4);
+            if(size > max_rom_size){
+                close();
+                error = "archive entry " + std::to_string(i) + " is too big for memory";
+                return false;
+            }
+            if(offset + size > length){
+                close();
+                error = "archive entry " + std::to_string(i) + " runs past the end of the file";
+                return false;
+            }
+            if(i > 0 && get(entry - entry_size, 8) >= get(entry, 8)){
+                close();
+                error = "archive table is not sorted by hash";
+                return false;
+            }
+        }
+        count = entries;
+        return true;
+    }
+    
+    void RomArchive::close(){
+#if ARCHIVE_MMAP
+        if(mapped){
+            munmap(const_cast<unsigned char*>(data), length);
+        }
+#endif
+        buffer.clear();
+        data = nullptr;
+        length = 0;
+        count = 0;
+        mapped = false;
+    }
+    
+    unsigned long long RomArchive::get_hash(size_t index) const {
+        return get(data + header_size + index * entry_size, 8);
+    }
+    
+    const unsigned char* RomArchive::get_rom(size_t index, size_t& rom_size) const {
+        const unsigned char* entry = data + header_size + index * entry_size;
+        rom_size = get(entry + 12, 4);
+        return data + get(entry + 8, 4);
+    }
+    
+    const unsigned char* RomArchive::find(unsigned long long hash, size_t& rom_size) const {
+        size_t low = 0;
+        size_t high = count;
+        while(low < high){
+            const size_t middle = low + (high - low) / 2;
+            const unsigned long long middle_hash = get_hash(middle);
+            if(middle_hash == hash){
+                return get_rom(middle, rom_size);
+            }
+            if(middle_hash < hash){
+                low = middle + 1;
+            }
+            else{
+                high = middle;
+            }
+        }
+        rom_size = 0;
+        return nullptr;
+    }
+    
+    bool RomArchive::write(std::string path, const std::vector<std::vector<unsigned char>>& roms, std::string& error){
+        //sorted and without duplicates; two different ROMs with one hash cannot both be found, so that is an error
+        std::map<unsigned long long, const std::vector<unsigned char>*> distinct;
+        for(size_t i = 0; i < roms.size(); i++){
+            if(roms[i].size() > max_rom_size){
+                error = "ROM " + std::to_string(i) + " is too big for memory";
+                return false;
+            }
+            const std::vector<unsigned char>*& rom = distinct[hash_bytes(roms[i].data(), roms[i].size())];
+            if(rom != nullptr && *rom != roms[i]){
+                error = "ROM " + std::to_string(i) + " has the same hash as a different ROM";
+                return false;
+            }
+            rom = &roms[i];
+        }
+        
+        std::vector<unsigned char> out(archive_magic, archive_magic + sizeof(archive_magic));
+        put(out, distinct.size(), 4);
+        size_t offset = header_size + distinct.size() * entry_size;
+        for(auto it = distinct.begin(); it != distinct.end(); ++it){
+            put(out, it->first, 8);
+            put(out, offset, 4);
+            put(out, it->second->size(), 4);
+            offset += it->second->size();
+        }
+        if(offset > 0xFFFFFFFFul){
+            error = "archive would be larger than 4 GB";
+            return false;
+        }
+        for(auto it = distinct.begin(); it != distinct.end(); ++it){
+            out.insert(out.end(), it->second->begin(), it->second->end());
+        }
+        
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(out.data()), out.size());
+        if(!file.good()){
+            error = "archive could not be written";
+            return false;
+        }
+        return true;
+    }
+}
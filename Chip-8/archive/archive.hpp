@@ -0,0 +1,48 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include<vector>
+#include<string>
+#include<cstddef>
+
+namespace chip{
+    //many ROMs in one file, for sweeps over whole corpora. Entries are looked up by the hash_bytes of their contents,
+    //so every distinct ROM is stored once however often it was packed. Little endian layout: the magic, the entry
+    //count (4 bytes), per entry its hash (8), offset (4) and size (4) sorted by hash, then the ROM bytes.
+    //The file is mapped rather than read, a ROM is only touched when a machine copies it into its memory
+    class RomArchive{
+    
+    public:
+        RomArchive();
+        ~RomArchive();
+        RomArchive(const RomArchive&) = delete;
+        RomArchive& operator=(const RomArchive&) = delete;
+        
+        //checks the whole table up front, including that every ROM fits above 0x200; false with a reason otherwise
+        bool open(std::string path, std::string& error);
+        void close();
+        
+        size_t size() const { return count; }
+        unsigned long long get_hash(size_t index) const;
+        //the bytes stay valid until the archive is closed
+        const unsigned char* get_rom(size_t index, size_t& rom_size) const;
+        //binary search over the table, nullptr if no ROM has that hash
+        const unsigned char* find(unsigned long long hash, size_t& rom_size) const;
+        
+        //packs the distinct ROMs among roms, false with a reason if one is too big or the file cannot be written
+        static bool write(std::string path, const std::vector<std::vector<unsigned char>>& roms, std::string& error);
+    
+    private:
+        static const size_t header_size = 12;
+        static const size_t entry_size = 16;
+        
+        const unsigned char* data;
+        size_t length;
+        size_t count;
+        //mapped, or read into buffer where the host cannot map files
+        bool mapped;
+        std::vector<unsigned char> buffer;
+    };
+}
+
+#endif
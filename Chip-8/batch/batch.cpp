@@ -0,0 +1,144 @@
+#include "batch.hpp"
+#include "hash.hpp"
+#include "lockstep.hpp"
+#include<thread>
+#include<mutex>
+#include<deque>
+#include<cstring>
+#include<map>
+
+namespace chip{
+    namespace{
+        //a worker takes from the back of its own queue and steals from the front of the others',
+        //so the locks are only contended when a worker has run dry
+        struct WorkQueue{
+            std::mutex mutex;
+            std::deque<size_t> jobs;
+        };
+        
+        bool pop_local(WorkQueue& queue, size_t& job){
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.jobs.empty()){
+                return false;
+            }
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+            return true;
+        }
+        
+        bool steal(WorkQueue& queue, size_t& job){
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.jobs.empty()){
+                return false;
+            }
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+            return true;
+        }
+    }
+    
+    BatchRunner::BatchRunner(unsigned int threads, int clock_hertz){
+        if(threads == 0){
+            threads = std::thread::hardware_concurrency();
+        }
+        this->threads = threads != 0 ? threads : 1;
+        this->clock_hertz = clock_hertz;
+        lockstep_lanes = 0;
+    }
+    
+    std::vector<JobResult> BatchRunner::run(const std::vector<Job>& jobs, bool use_jit){
+        std::vector<JobResult> results(jobs.size());
+        std::vector<WorkQueue> queues(threads);
+        
+        //a task is one job, or in lockstep mode up to lockstep_lanes jobs sharing a ROM
+        std::vector<std::vector<size_t>> tasks;
+        if(lockstep_lanes == 0){
+            for(size_t i = 0; i < jobs.size(); i++){
+                tasks.push_back(std::vector<size_t>(1, i));
+            }
+        }
+        else{
+            std::map<const unsigned char*, size_t> open_task;
+            for(size_t i = 0; i < jobs.size(); i++){
+                //the lockstep interpreter only knows the original behaviour
+                if(jobs[i].quirks != QUIRKS_CHIP8){
+                    tasks.push_back(std::vector<size_t>(1, i));
+                    continue;
+                }
+                const unsigned char* rom = jobs[i].rom.get();
+                auto it = open_task.find(rom);
+                if(it == open_task.end() || tasks[it->second].size() == lockstep_lanes){
+                    open_task[rom] = tasks.size();
+                    tasks.push_back(std::vector<size_t>());
+                }
+                tasks[open_task[rom]].push_back(i);
+            }
+        }
+        
+        //contiguous ranges keep each worker on neighbouring tasks until it starts stealing
+        for(size_t i = 0; i < tasks.size(); i++){
+            queues[i * threads / tasks.size()].jobs.push_back(i);
+        }
+        
+        auto worker = [&](unsigned int id){
+            HeadlessFrontend frontend(0, 0);
+            Chip chip(clock_hertz, frontend);
+            if(use_jit && lockstep_lanes == 0){
+                chip.enable_jit();
+            }
+            Lockstep lockstep(clock_hertz);
+            
+            size_t index;
+            while(true){
+                bool found = pop_local(queues[id], index);
+                for(unsigned int i = 1; !found && i < threads; i++){
+                    found = steal(queues[(id + i) % threads], index);
+                }
+                if(!found){
+                    break;
+                }
+                
+                const std::vector<size_t>& task = tasks[index];
+                
+                if(lockstep_lanes != 0 && jobs[task[0]].quirks == QUIRKS_CHIP8){
+                    std::vector<Job> group;
+                    for(size_t i = 0; i < task.size(); i++){
+                        group.push_back(jobs[task[i]]);
+                    }
+                    std::vector<JobResult> group_results = lockstep.run(group);
+                    for(size_t i = 0; i < task.size(); i++){
+                        results[task[i]] = group_results[i];
+                    }
+                    continue;
+                }
+                
+                const Job& job = jobs[task[0]];
+                JobResult& result = results[task[0]];
+                
+                frontend.set_limits(0, job.cycles);
+                frontend.set_input(&job.input);
+                chip.set_seed(job.seed);
+                chip.set_quirks(job.quirks);
+                
+                result.message = chip.run(job.rom.get(), job.rom_size);
+                result.exit_reason = chip.get_exit_reason();
+                result.display_hash = hash_bytes(chip.get_display().rows, sizeof(Framebuffer::rows));
+                memcpy(result.v, chip.get_registers(), sizeof(result.v));
+                result.I = chip.get_I();
+                result.pc = chip.get_pc();
+                result.cycles = chip.get_cycle_count();
+            }
+        };
+        
+        std::vector<std::thread> pool;
+        for(unsigned int i = 1; i < threads; i++){
+            pool.emplace_back(worker, i);
+        }
+        worker(0);
+        for(size_t i = 0; i < pool.size(); i++){
+            pool[i].join();
+        }
+        
+        return results;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "chip.hpp"
+#include "headless_frontend.hpp"
+#include<vector>
+#include<memory>
+#include<string>
+
+namespace chip{
+    //one independent headless run
+    struct Job{
+        //kept alive by whatever holds the bytes (a vector, a RomArchive), the pointer itself is the ROM
+        std::shared_ptr<const unsigned char> rom;
+        size_t rom_size;
+        std::vector<InputEvent> input; //sorted by cycle
+        unsigned long cycles; //budget, must not be 0
+        unsigned int seed; //for Cxkk, 0 uses the default
+        QuirkProfile quirks;
+    };
+    
+    struct JobResult{
+        Chip::ExitReason exit_reason;
+        std::string message;
+        unsigned long long display_hash;
+        unsigned char v[16];
+        unsigned short I;
+        unsigned short pc;
+        unsigned long cycles;
+    };
+    
+    //runs jobs on a fixed set of worker threads, each with its own machine; idle workers steal queued jobs from busy ones
+    class BatchRunner{
+    
+    public:
+        //threads == 0 uses every hardware thread
+        BatchRunner(unsigned int threads, int clock_hertz);
+        
+        //results[i] belongs to jobs[i]
+        std::vector<JobResult> run(const std::vector<Job>& jobs, bool use_jit);
+        
+        unsigned int get_threads() const { return threads; }
+        
+        //run jobs that share a ROM together on the SIMD lockstep interpreter, up to lanes at a time (0 turns it off).
+        //Jobs with a quirk profile other than QUIRKS_CHIP8 still run one by one
+        void set_lockstep(unsigned int lanes){ lockstep_lanes = lanes; }
+    
+    private:
+        unsigned int threads;
+        int clock_hertz;
+        unsigned int lockstep_lanes;
+    };
+}
+
+#endif
@@ -0,0 +1,366 @@
+#include "chip.hpp"
+#include "headless_frontend.hpp"
+#include "archive.hpp"
+#include "hash.hpp"
+#include "debugger.hpp"
+#include "metrics.hpp"
+#include "roms.hpp"
+#include<cstring>
+#include<cstdio>
+#include<filesystem>
+#include<iomanip>
+#include<vector>
+#include<string>
+
+//Interpreter throughput, profiler, debugger and metrics overhead, machine forking and ROM archive benchmarks.
+//Usage: chip8-bench [--json] [--jit] [--scale X] [rom ...]
+//  --json      Print one JSON object instead of a table, for tracking results between commits
+//  --jit       Run everything with the JIT enabled
+//  --scale X   Multiply the amount of work per benchmark by X (default 1)
+//  rom ...     Extra ROM files to measure full-ROM frames per second on, next to the synthetic ones
+
+namespace{
+    struct Result{
+        std::string benchmark;
+        std::string metric;
+        double value;
+        std::string unit;
+    };
+
+    struct Measurement{
+        unsigned long cycles;
+        unsigned long frames;
+        unsigned long fused_pairs;
+        double seconds;
+    };
+
+    struct ForkMeasurement{
+        double copies_per_second;
+        double branches_per_second;
+        double bytes_per_fork;
+    };
+
+    //search-style forking: plain copies of one fork, then branches that each continue a copy for a frame with a
+    //different key held and save the result as a fork of their own
+    ForkMeasurement fork_rom(const std::vector<unsigned char>& rom, int forks){
+        chip::HeadlessFrontend frontend(60, 0);
+        chip::Chip chip(chip::Chip::default_clock_hertz, frontend);
+        chip.run(rom.data(), rom.size());
+        chip::Fork root;
+        chip.save_fork(root);
+
+        ForkMeasurement m;
+        std::vector<chip::Fork> copies(forks);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < forks; i++){
+            copies[i] = root;
+        }
+        auto end = std::chrono::steady_clock::now();
+        m.copies_per_second = forks / std::chrono::duration<double>(end - start).count();
+
+        frontend.set_limits(1, 0);
+        std::vector<chip::Fork> branches(forks);
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < forks; i++){
+            chip::Fork branch = root;
+            branch.keys = 1 << (i % 16);
+            chip.run(branch);
+            chip.save_fork(branches[i]);
+        }
+        end = std::chrono::steady_clock::now();
+        m.branches_per_second = forks / std::chrono::duration<double>(end - start).count();
+
+        //the machine still holds the last branch's pages, leave it out
+        size_t bytes = 0;
+        for(int i = 0; i < forks - 1; i++){
+            bytes += sizeof(chip::Fork) + branches[i].private_bytes();
+        }
+        m.bytes_per_fork = forks > 1 ? (double)bytes / (forks - 1) : 0;
+        return m;
+    }
+
+    struct ArchiveMeasurement{
+        double open_seconds;
+        double loads_per_second;
+    };
+
+    //a corpus of variants of one ROM (each with its index appended) packed into a temporary archive, then opened
+    //and every entry looked up by hash and loaded into a machine, as a batch over the archive starts its jobs
+    ArchiveMeasurement archive_roms(const std::vector<unsigned char>& rom, int count){
+        std::vector<std::vector<unsigned char>> roms(count, rom);
+        std::vector<unsigned long long> hashes(count);
+        for(int i = 0; i < count; i++){
+            roms[i].push_back(i >> 8);
+            roms[i].push_back(i & 0xFF);
+            hashes[i] = chip::hash_bytes(roms[i].data(), roms[i].size());
+        }
+        const std::string path = (std::filesystem::temp_directory_path() / "chip8-bench.c8a").string();
+        std::string error;
+        ArchiveMeasurement m = {0, 0};
+        if(!chip::RomArchive::write(path, roms, error)){
+            std::cerr << "archive benchmark skipped, " << error << std::endl;
+            return m;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        chip::RomArchive archive;
+        archive.open(path, error);
+        auto end = std::chrono::steady_clock::now();
+        m.open_seconds = std::chrono::duration<double>(end - start).count();
+
+        chip::Chip chip(chip::Chip::default_clock_hertz);
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < count; i++){
+            size_t size;
+            const unsigned char* data = archive.find(hashes[i], size);
+            chip.load(data, size);
+        }
+        end = std::chrono::steady_clock::now();
+        m.loads_per_second = count / std::chrono::duration<double>(end - start).count();
+
+        archive.close();
+        std::remove(path.c_str());
+        return m;
+    }
+
+    //profiler attached if not null, which bypasses the JIT
+    Measurement run_rom(const std::vector<unsigned char>& rom, int clock_hertz, unsigned long frames, bool jit, chip::Profiler* profiler = nullptr){
+        chip::HeadlessFrontend frontend(frames, 0);
+        chip::Chip chip(clock_hertz, frontend);
+        if(jit){
+            chip.enable_jit();
+        }
+        chip.set_profiler(profiler);
+
+        auto start = std::chrono::steady_clock::now();
+        chip.run(rom.data(), rom.size());
+        auto end = std::chrono::steady_clock::now();
+
+        Measurement m;
+        m.cycles = chip.get_cycle_count();
+        m.frames = chip.get_frame_stats().frames;
+        m.fused_pairs = chip.get_frame_stats().fused_pairs;
+        m.seconds = std::chrono::duration<double>(end - start).count();
+        return m;
+    }
+
+    //run_rom with metrics collected and sampled every 10 ms by a publisher that throws the samples away
+    Measurement run_rom_measured(const std::vector<unsigned char>& rom, int clock_hertz, unsigned long frames, bool jit){
+        chip::HeadlessFrontend frontend(frames, 0);
+        chip::Chip chip(clock_hertz, frontend);
+        if(jit){
+            chip.enable_jit();
+        }
+        chip::Metrics metrics;
+        chip::MetricsPublisher publisher(metrics, 0.01);
+        chip.set_metrics(&metrics);
+
+        auto start = std::chrono::steady_clock::now();
+        publisher.start();
+        chip.run(rom.data(), rom.size());
+        publisher.stop();
+        auto end = std::chrono::steady_clock::now();
+
+        Measurement m;
+        m.cycles = chip.get_cycle_count();
+        m.frames = chip.get_frame_stats().frames;
+        m.fused_pairs = chip.get_frame_stats().fused_pairs;
+        m.seconds = std::chrono::duration<double>(end - start).count();
+        return m;
+    }
+
+    //the same run driven a frame at a time from outside through Chip::run_frame, as an embedding host would
+    Measurement run_rom_hosted(const std::vector<unsigned char>& rom, int clock_hertz, unsigned long frames, bool jit){
+        chip::Chip chip(clock_hertz);
+        if(jit){
+            chip.enable_jit();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        chip.load(rom.data(), rom.size());
+        unsigned long frame = 0;
+        while(frame < frames && chip.run_frame() == -1){
+            frame++;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        Measurement m;
+        m.cycles = chip.get_cycle_count();
+        m.frames = frame;
+        m.fused_pairs = 0;
+        m.seconds = std::chrono::duration<double>(end - start).count();
+        return m;
+    }
+
+    //the host loop above through a Debugger, with nothing set and then with a breakpoint that is never reached
+    Measurement run_rom_debugged(const std::vector<unsigned char>& rom, int clock_hertz, unsigned long frames, bool jit, bool breakpoint){
+        chip::Chip chip(clock_hertz);
+        if(jit){
+            chip.enable_jit();
+        }
+        chip::Debugger debugger(chip);
+        if(breakpoint){
+            std::ostringstream ignored;
+            debugger.command("break FFE", ignored);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        chip.load(rom.data(), rom.size());
+        debugger.resume(0, frames);
+        auto end = std::chrono::steady_clock::now();
+
+        Measurement m;
+        m.cycles = chip.get_cycle_count();
+        m.frames = chip.get_frames();
+        m.fused_pairs = 0;
+        m.seconds = std::chrono::duration<double>(end - start).count();
+        return m;
+    }
+
+    //time to set up a machine, load a ROM and run its first frame
+    double startup_seconds(const std::vector<unsigned char>& rom, int iterations, bool jit){
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < iterations; i++){
+            chip::HeadlessFrontend frontend(1, 0);
+            chip::Chip chip(0, frontend);
+            if(jit){
+                chip.enable_jit();
+            }
+            chip.run(rom.data(), rom.size());
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - start).count() / iterations;
+    }
+
+    void print_table(const std::vector<Result>& results){
+        for(size_t i = 0; i < results.size(); i++){
+            const Result& r = results[i];
+            std::cout << std::left << std::setw(24) << r.benchmark << std::setw(24) << r.metric
+                << std::right << std::setw(16) << std::fixed << std::setprecision(2) << r.value << " " << r.unit << "\n";
+        }
+    }
+
+    std::string json_string(const std::string& s){
+        std::string out = "\"";
+        for(size_t i = 0; i < s.size(); i++){
+            if(s[i] == '"' || s[i] == '\\'){
+                out += '\\';
+            }
+            out += s[i];
+        }
+        return out + "\"";
+    }
+
+    void print_json(const std::vector<Result>& results, bool jit){
+        std::cout << "{\"jit\": " << (jit ? "true" : "false") << ", \"results\": [";
+        for(size_t i = 0; i < results.size(); i++){
+            const Result& r = results[i];
+            std::cout << (i == 0 ? "\n" : ",\n") << "  {\"benchmark\": " << json_string(r.benchmark)
+                << ", \"metric\": " << json_string(r.metric)
+                << ", \"value\": " << std::setprecision(10) << r.value
+                << ", \"unit\": " << json_string(r.unit) << "}";
+        }
+        std::cout << "\n]}" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    bool jit = false;
+    double scale = 1;
+    std::vector<std::string> rom_paths;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--json") == 0){
+            json = true;
+        }
+        else if(strcmp(argv[i], "--jit") == 0){
+            jit = true;
+        }
+        else if(strcmp(argv[i], "--scale") == 0 && i + 1 < argc){
+            scale = strtod(argv[++i], nullptr);
+        }
+        else{
+            rom_paths.push_back(argv[i]);
+        }
+    }
+
+    std::vector<Result> results;
+
+    //opcode families: a fast clock so that every frame is one long burst, the timers hardly matter
+    struct Family{
+        const char* name;
+        std::vector<unsigned char> rom;
+        unsigned long frames;
+    };
+    const Family families[] = {
+        {"alu_8xy", bench::alu_rom(), 600},
+        {"draw_dxyn", bench::draw_rom(), 150},
+        {"memory_fx55_fx65", bench::memory_rom(), 150},
+        {"branch", bench::branch_rom(), 600}
+    };
+    const int burst_hertz = 60 * 100000;
+    for(const Family& family : families){
+        Measurement m = run_rom(family.rom, burst_hertz, family.frames * scale + 1, jit);
+        results.push_back({family.name, "instructions_per_second", m.cycles / m.seconds, "instr/s"});
+        results.push_back({family.name, "fused_instructions", 200.0 * m.fused_pairs / m.cycles, "%"});
+    }
+
+    //the profiler against the interpreter it runs on, at full speed where every bit of overhead shows
+    const unsigned long busy_frames = 600 * scale + 1;
+    Measurement plain = run_rom(bench::busy_rom(), burst_hertz, busy_frames, false);
+    chip::Profiler profiler;
+    Measurement profiled = run_rom(bench::busy_rom(), burst_hertz, busy_frames, false, &profiler);
+    results.push_back({"profiler", "instructions_per_second", profiled.cycles / profiled.seconds, "instr/s"});
+    results.push_back({"profiler", "overhead", 100 * (1 - (profiled.cycles / profiled.seconds) / (plain.cycles / plain.seconds)), "%"});
+
+    //whole ROMs at a typical game clock: how many 60 Hz frames we can emulate per second
+    const int game_hertz = 1000;
+    const unsigned long game_frames = 200000 * scale + 1;
+    Measurement game = run_rom(bench::game_rom(), game_hertz, game_frames, jit);
+    results.push_back({"rom:synthetic_game", "frames_per_second", game.frames / game.seconds, "frames/s"});
+    results.push_back({"rom:synthetic_game", "instructions_per_second", game.cycles / game.seconds, "instr/s"});
+    results.push_back({"rom:synthetic_game", "fused_instructions", 200.0 * game.fused_pairs / game.cycles, "%"});
+    Measurement hosted = run_rom_hosted(bench::game_rom(), game_hertz, game_frames, jit);
+    results.push_back({"rom:synthetic_game", "hosted_frames_per_second", hosted.frames / hosted.seconds, "frames/s"});
+    Measurement attached = run_rom_debugged(bench::game_rom(), game_hertz, game_frames, jit, false);
+    results.push_back({"debugger", "frames_per_second", attached.frames / attached.seconds, "frames/s"});
+    Measurement breakpoint = run_rom_debugged(bench::game_rom(), game_hertz, game_frames, jit, true);
+    results.push_back({"debugger", "frames_per_second_break", breakpoint.frames / breakpoint.seconds, "frames/s"});
+    Measurement measured = run_rom_measured(bench::game_rom(), game_hertz, game_frames, jit);
+    results.push_back({"metrics", "frames_per_second", measured.frames / measured.seconds, "frames/s"});
+
+    for(size_t i = 0; i < rom_paths.size(); i++){
+        std::ifstream file(rom_paths[i], std::ios::binary);
+        if(!file){
+            std::cerr << "ROM could not be loaded: " << rom_paths[i] << std::endl;
+            return 1;
+        }
+        std::vector<unsigned char> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        Measurement m = run_rom(rom, game_hertz, game_frames, jit);
+        results.push_back({"rom:" + rom_paths[i], "frames_per_second", m.frames / m.seconds, "frames/s"});
+        results.push_back({"rom:" + rom_paths[i], "instructions_per_second", m.cycles / m.seconds, "instr/s"});
+        results.push_back({"rom:" + rom_paths[i], "fused_instructions", 200.0 * m.fused_pairs / m.cycles, "%"});
+    }
+
+    ForkMeasurement fork = fork_rom(bench::score_rom(), 20000 * scale + 2);
+    results.push_back({"fork", "copies_per_second", fork.copies_per_second, "forks/s"});
+    results.push_back({"fork", "branches_per_second", fork.branches_per_second, "forks/s"});
+    results.push_back({"fork", "memory_per_fork", fork.bytes_per_fork, "bytes"});
+
+    ArchiveMeasurement archive = archive_roms(bench::game_rom(), 10000 * scale + 1);
+    results.push_back({"archive", "open_time", archive.open_seconds * 1e3, "ms"});
+    results.push_back({"archive", "loads_per_second", archive.loads_per_second, "roms/s"});
+
+    const int startup_iterations = 2000 * scale + 1;
+    results.push_back({"startup", "time_to_first_frame", startup_seconds(bench::game_rom(), startup_iterations, jit) * 1e6, "us"});
+
+    if(json){
+        print_json(results, jit);
+    }
+    else{
+        print_table(results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef BENCH_ROMS_HPP
+#define BENCH_ROMS_HPP
+
+#include<vector>
+
+//the synthetic ROMs the benchmarks run, shared with the tests that check every way of running them agrees
+namespace bench{
+    inline std::vector<unsigned char> to_bytes(const std::vector<unsigned short>& words){
+        std::vector<unsigned char> bytes;
+        for(size_t i = 0; i < words.size(); i++){
+            bytes.push_back(words[i] >> 8);
+            bytes.push_back(words[i] & 0xFF);
+        }
+        return bytes;
+    }
+    
+    //setup, then body repeated repeat times in a loop closed by a jump back to the first copy
+    inline std::vector<unsigned char> loop_rom(const std::vector<unsigned short>& setup, const std::vector<unsigned short>& body, int repeat){
+        std::vector<unsigned short> words = setup;
+        const unsigned short loop = 0x200 + 2 * setup.size();
+        for(int i = 0; i < repeat; i++){
+            words.insert(words.end(), body.begin(), body.end());
+        }
+        words.push_back(0x1000 | loop);
+        return to_bytes(words);
+    }
+    
+    //8xy* only
+    inline std::vector<unsigned char> alu_rom(){
+        return loop_rom({0x6001, 0x6102, 0x6203, 0x6304, 0x6405, 0x6506},
+            {0x8014, 0x8125, 0x8236, 0x8347, 0x801E, 0x8451, 0x8562, 0x8013, 0x8120, 0x8237}, 6);
+    }
+    
+    //DXYN with 5 row font sprites at spread out coordinates
+    inline std::vector<unsigned char> draw_rom(){
+        return loop_rom({0xA000, 0x6000, 0x6108, 0x6210, 0x6318, 0x6420, 0x6528, 0x6630, 0x673C},
+            {0xD015, 0xD235, 0xD455, 0xD675, 0xD105, 0xD325, 0xD545, 0xD765}, 8);
+    }
+    
+    //Fx55 and Fx65 over all 16 registers, away from the code
+    inline std::vector<unsigned char> memory_rom(){
+        return loop_rom({0xA800}, {0xFF55, 0xFF65}, 30);
+    }
+    
+    //taken skips, calls and returns
+    inline std::vector<unsigned char> branch_rom(){
+        const std::vector<unsigned short> setup = {0x6000, 0x6100};
+        const std::vector<unsigned short> unit = {0x3000, 0x0000, 0x4001, 0x0000, 0x5010, 0x0000, 0x2000};
+        const int repeat = 8;
+        const unsigned short loop = 0x200 + 2 * setup.size();
+        const unsigned short subroutine = loop + 2 * (unit.size() * repeat + 1);
+        
+        std::vector<unsigned short> words = setup;
+        for(int i = 0; i < repeat; i++){
+            words.insert(words.end(), unit.begin(), unit.end());
+            words.back() |= subroutine;
+        }
+        words.push_back(0x1000 | loop);
+        words.push_back(0x00EE);
+        return to_bytes(words);
+    }
+    
+    //something shaped like a game: clear, draw a few sprites at random places, then wait out the delay timer
+    inline std::vector<unsigned char> game_rom(){
+        return to_bytes({
+            0x00E0,
+            0xC03F, 0xC11F, 0xC20F, 0xF229, 0xD015, //0x202
+            0xC03F, 0xC11F, 0xD015,
+            0xC03F, 0xC11F, 0xD015,
+            0x6302, 0xF315,
+            0xF407, 0x3400, 0x121C, //0x21C wait
+            0x00E0, 0x1202
+        });
+    }
+    
+    //never idle: a 16-bit counter, a subroutine call, taken and untaken skips and a draw every fourth iteration
+    inline std::vector<unsigned char> busy_rom(){
+        return to_bytes({
+            0x6000, 0x6100, 0xA000,
+            0x7001, 0x4000, 0x7101, //0x206 loop
+            0x2220,
+            0x8200, 0x8214, 0x6303, 0x8232,
+            0x4200, 0xD015,
+            0x1206,
+            0x0000, 0x0000,
+            0x8400, 0x8415, 0x8446, 0x00EE //0x220
+        });
+    }
+    
+    //a score counter: once per frame the counter goes through Fx33 into memory and its digits are drawn
+    inline std::vector<unsigned char> score_rom(){
+        return to_bytes({
+            0x6300,
+            0x7301, 0xA300, 0xF333, 0xF265, //0x202
+            0x00E0, 0x6400, 0x6500,
+            0xF029, 0xD455, 0x6406, 0xF129, 0xD455, 0x640C, 0xF229, 0xD455,
+            0x6601, 0xF615,
+            0xF607, 0x3600, 0x1224, //0x224 wait
+            0x1202
+        });
+    }
+}
+
+#endif
@@ -1,9 +1,55 @@
 #include "chip.hpp"
-
-#define PRINT_OPCODES 1
+#include "headless_frontend.hpp"
+#include<algorithm>
 
 namespace chip{
-    Chip::Chip(int clock_hertz){
+    const unsigned int Chip::default_seed;
+    const int Chip::default_clock_hertz;
+    
+    const unsigned char Chip::font_set[5 * 16] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, //0
+        0x20, 0x60, 0x20, 0x20, 0x70, //1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
+        0x90, 0x90, 0xF0, 0x10, 0x10, //4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
+        0xF0, 0x10, 0x20, 0x40, 0x40, //7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, //A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, //C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, //D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  //F
+    };
+    
+    Chip::Chip(int clock_hertz, Frontend& frontend) : frontend(frontend){
+        jit = nullptr;
+        tracer = nullptr;
+        profiler = nullptr;
+        metrics = nullptr;
+        resume_state = nullptr;
+        rewind = nullptr;
+        seed = default_seed;
+        speed = 1;
+        set_turbo(0, 0, false);
+        frame_stats = FrameStats();
+        exit_reason = EXIT_NONE;
+        dirty_pages = ~0u;
+        set_quirks(QUIRKS_CHIP8);
+        owned_frontend = nullptr;
+        host_frames = 0;
+        frame_left = 0;
+        sounding = false;
+        breakpoint_count = 0;
+        watchpoint_count = 0;
+        watch_hit = -1;
+        //memory and the decode cache start out agreeing, so a fork loaded before any ROM only rewrites what differs
+        init_cpu();
+        display.clear();
+        
         if(clock_hertz == 0){
             
             this->clock_hertz = default_clock_hertz;
@@ -12,66 +58,472 @@ namespace chip{
             this->clock_hertz = clock_hertz;
         }
     }
+    Chip::Chip(int clock_hertz) : Chip(clock_hertz, *new HeadlessFrontend(0, 0)){
+        owned_frontend = &frontend;
+    }
     Chip::~Chip(){
+        delete owned_frontend;
+        delete jit;
+        delete resume_state;
+        delete rewind;
+    }
+    
+    bool Chip::enable_jit(){
+        if(jit == nullptr){
+            jit = new Jit();
+        }
+        if(!jit->available()){
+            delete jit;
+            jit = nullptr;
+            return false;
+        }
+        return true;
+    }
+    
+    void Chip::set_turbo(double speed, unsigned int frame_skip, bool always){
+        turbo_speed = speed > 0 ? speed : 0;
+        turbo_always = always;
+        if(frame_skip == 0){
+            frame_skip = turbo_speed > 0 ? (unsigned int)std::ceil(turbo_speed) : 10;
+        }
+        turbo_frame_skip = frame_skip;
+    }
+    
+    void Chip::set_quirks(QuirkProfile profile){
+        quirks = profile;
+        switch(profile){
+            case QUIRKS_VIP: use_quirks<QuirksVip>(); break;
+            case QUIRKS_SCHIP: use_quirks<QuirksSchip>(); break;
+            case QUIRKS_XOCHIP: use_quirks<QuirksXochip>(); break;
+            default:
+                quirks = QUIRKS_CHIP8;
+                use_quirks<QuirksChip8>();
+                break;
+        }
+    }
+    
+    template<typename Quirks> void Chip::use_quirks(){
+        interpreters[0] = &Chip::interpret<Quirks, false>;
+        interpreters[1] = &Chip::interpret<Quirks, true>;
+    }
+    
+    void Chip::save_state(MachineState& state) const {
+        memcpy(state.memory, memory, sizeof(memory));
+        memcpy(state.v, v, sizeof(v));
+        state.I = I;
+        state.pc = pc;
+        const unsigned short held = keys.load(std::memory_order_relaxed);
+        for(int i = 0; i < 16; i++){
+            state.stack[i] = stack[i];
+            state.keys[i] = (held >> i) & 1;
+        }
+        state.stack_ptr = stack_ptr;
+        state.delay_timer = delay_timer;
+        state.sound_timer = sound_timer;
+        state.random_state = random_state;
+        state.cycle_count = cycle_count;
+        state.display = display;
+    }
+    
+    void Chip::load_state(const MachineState& state, bool keep_keys){
+        memcpy(memory, state.memory, sizeof(memory));
+        memcpy(v, state.v, sizeof(v));
+        I = state.I;
+        pc = state.pc;
+        unsigned short held = 0;
+        for(int i = 0; i < 16; i++){
+            stack[i] = state.stack[i];
+            held |= (state.keys[i] ? 1 : 0) << i;
+        }
+        if(!keep_keys){
+            keys.store(held, std::memory_order_relaxed);
+        }
+        stack_ptr = state.stack_ptr;
+        delay_timer = state.delay_timer;
+        sound_timer = state.sound_timer;
+        random_state = state.random_state;
+        cycle_count = state.cycle_count;
+        display = state.display;
+        
+        //memory may hold different code now
+        invalidate_all();
+    }
+    
+    void Chip::save_fork(Fork& fork){
+        static_assert(Fork::page_count <= 32, "dirty_pages has a bit per page");
+        for(int i = 0; i < Fork::page_count; i++){
+            if((dirty_pages >> i) & 1){
+                pages[i] = std::make_shared<Fork::Page>();
+                memcpy(pages[i]->bytes, &memory[i * Fork::page_size], Fork::page_size);
+            }
+            fork.pages[i] = pages[i];
+        }
+        dirty_pages = 0;
+        
+        memcpy(fork.v, v, sizeof(v));
+        for(int i = 0; i < 16; i++){
+            fork.stack[i] = stack[i];
+        }
+        fork.I = I;
+        fork.pc = pc;
+        fork.stack_ptr = stack_ptr;
+        fork.delay_timer = delay_timer;
+        fork.sound_timer = sound_timer;
+        fork.keys = keys.load(std::memory_order_relaxed);
+        fork.random_state = random_state;
+        fork.cycle_count = cycle_count;
+        fork.display = display;
+    }
+    
+    void Chip::load_fork(const Fork& fork){
+        for(int i = 0; i < Fork::page_count; i++){
+            if(((dirty_pages >> i) & 1) || pages[i] != fork.pages[i]){
+                unsigned char* page = &memory[i * Fork::page_size];
+                const unsigned char* bytes = fork.pages[i]->bytes;
+                for(int j = 0; j < Fork::page_size; j++){
+                    if(page[j] != bytes[j]){
+                        page[j] = bytes[j];
+                        invalidate(i * Fork::page_size + j);
+                    }
+                }
+                pages[i] = fork.pages[i];
+            }
+        }
+        dirty_pages = 0;
+        
+        memcpy(v, fork.v, sizeof(v));
+        for(int i = 0; i < 16; i++){
+            stack[i] = fork.stack[i];
+        }
+        I = fork.I;
+        pc = fork.pc;
+        stack_ptr = fork.stack_ptr;
+        delay_timer = fork.delay_timer;
+        sound_timer = fork.sound_timer;
+        keys.store(fork.keys, std::memory_order_relaxed);
+        random_state = fork.random_state;
+        cycle_count = fork.cycle_count;
+        display = fork.display;
+    }
+    
+    void Chip::set_resume_state(const MachineState* state){
+        delete resume_state;
+        resume_state = state != nullptr ? new MachineState(*state) : nullptr;
+    }
+    
+    void Chip::enable_rewind(size_t capacity_bytes){
+        delete rewind;
+        rewind = capacity_bytes != 0 ? new Rewind(capacity_bytes) : nullptr;
     }
     
     std::string Chip::run(std::string path){
         init_cpu();
         init_keyboard();
+        display.clear();
         
-        if(!init_display()){
+        if(!frontend.init()){
+            exit_reason = EXIT_INIT_FAILED;
             return "Error: Display could not be initialized.";
         }
         
         if(!load_game(path)){
+            frontend.clean_up();
+            exit_reason = EXIT_LOAD_FAILED;
             return "Error: ROM could not be loaded.";
         }
         
+        return run_loaded();
+    }
+    
+    std::string Chip::run(const unsigned char* rom, size_t size){
+        init_cpu();
+        init_keyboard();
+        display.clear();
+        
+        if(!frontend.init()){
+            exit_reason = EXIT_INIT_FAILED;
+            return "Error: Display could not be initialized.";
+        }
+        
+        if(!load_game(rom, size)){
+            frontend.clean_up();
+            exit_reason = EXIT_LOAD_FAILED;
+            return "Error: ROM could not be loaded.";
+        }
+        
+        return run_loaded();
+    }
+    
+    bool Chip::load(const unsigned char* rom, size_t size){
+        init_cpu();
+        init_keyboard();
+        display.clear();
+        host_frames = 0;
+        frame_left = 0;
+        sounding = false;
+        return load_game(rom, size);
+    }
+    
+    int Chip::step(unsigned long count){
+        return execute(count);
+    }
+    
+    int Chip::run_frame(unsigned long limit){
+        if(frame_left == 0){
+            frame_left = frame_cycles(host_frames);
+        }
+        const unsigned long start = cycle_count;
+        const int pc = execute(frame_left < limit ? frame_left : limit);
+        frame_left -= cycle_count - start;
+        if(pc != -1 || frame_left != 0){
+            return pc;
+        }
+        host_frames++;
+        sounding = sound_timer > 0;
+        update_timers();
+        return -1;
+    }
+    
+    void Chip::set_breakpoint(unsigned short address, bool on){
+        address &= 0xFFF;
+        if(breakpoints[address] == on){
+            return;
+        }
+        breakpoints[address] = on;
+        breakpoint_count += on ? 1 : -1;
+        //decoded again on the next visit, with or without the trap, like a write there. Not through invalidate: the
+        //memory did not change, so neither forks nor the JIT need to hear about it
+        for(int i = 0; i < 4; i++){
+            decoded[(address - i) & 0xFFF].op = OP_DECODE;
+        }
+    }
+    
+    void Chip::set_watchpoint(unsigned short address, bool on){
+        address &= 0xFFF;
+        if(watchpoints[address] == on){
+            return;
+        }
+        watchpoints[address] = on;
+        watchpoint_count += on ? 1 : -1;
+    }
+    
+    std::string Chip::run(const Fork& fork){
+        exit_reason = EXIT_NONE;
+        
+        if(!frontend.init()){
+            exit_reason = EXIT_INIT_FAILED;
+            return "Error: Display could not be initialized.";
+        }
+        
+        load_fork(fork);
+        return run_machine();
+    }
+    
+    std::string Chip::run_loaded(){
+        if(resume_state != nullptr){
+            //the frontend reports the keys from here on, not the ones held when the state was saved
+            load_state(*resume_state, true);
+        }
+        return run_machine();
+    }
+    
+    std::string Chip::run_machine(){
+        if(rewind != nullptr){
+            rewind->clear();
+        }
+        if(profiler != nullptr){
+            //sixteen samples a frame, so that slow real-time clocks are profiled exactly
+            profiler->restart(clock_hertz / 60 / 16);
+        }
+        
+        int pc = run_frames();
+        
+        if(profiler != nullptr){
+            profiler->flush();
+        }
+        
+        frontend.clean_up();
+        
+        if(pc != -1 && has_breakpoint(pc)){
+            exit_reason = EXIT_BREAKPOINT;
+            std::stringstream stream;
+            stream << "Stopped at breakpoint " << std::hex << pc << ".";
+            return stream.str();
+        }
+        else if(pc != -1){
+            exit_reason = EXIT_INVALID_OPCODE;
+            std::stringstream stream;
+            unsigned short opcode = fetch(pc);
+            stream << "Error: Opcode " << std::hex << opcode << " at memory address " << pc << " is invalid.";
+            return stream.str();
+        }
+        else if(frontend.cycle_limit() != 0 && cycle_count >= frontend.cycle_limit()){
+            exit_reason = EXIT_CYCLE_LIMIT;
+            return "Cycle limit reached.";
+        }
+        else{
+            exit_reason = EXIT_QUIT;
+            return frontend.quit_message();
+        }
+    }
+    
+    //bursts of clock_hertz / 60 instructions, each followed by exactly one timer tick and one display update.
+    //Throttled frontends then wait for an absolute deadline, so oversleeping in one frame is made up in the next
+    //instead of accumulating as drift
+    int Chip::run_frames(){
+        typedef std::chrono::steady_clock clock;
+        const unsigned long limit = frontend.cycle_limit();
+        //sleeps overshoot by up to a scheduler tick, so the last stretch before a deadline is spent yielding instead
+        const clock::duration spin = std::chrono::microseconds(500);
+        
+        frame_stats = FrameStats();
+        double total_late_us = 0;
+        unsigned long paced_frames = 0;
+        const clock::time_point start = clock::now();
+        clock::time_point deadline = start;
+        bool was_paced = false;
+        unsigned int skipped = 0;
+        
+        //with metrics, each frame's host time is cut at the phase boundaries; a frame starts where the last one ended
+        uint64_t mark = metrics != nullptr ? Profiler::now() : 0;
+        uint64_t tick = 0;
+        
         int pc = -1;
-        bool running = true;
-        while(running){
-            auto start = std::chrono::steady_clock::now();
-            
-            
-            if(!update_keys()){
-                running = false;
+        for(unsigned long frame = 0; limit == 0 || cycle_count < limit; frame++){
+            const uint64_t keys_start = profiler != nullptr ? Profiler::now() : 0;
+            if(!frontend.update_keys(keys, cycle_count)){
                 break;
             }
-            
-            pc = execute_cycle();
-            if(pc != -1){
-                running = false;
-                break;
+            if(profiler != nullptr){
+                profiler->add_time(Profiler::SECTION_KEYS, keys_start);
+            }
+            const unsigned long frame_start_cycle = cycle_count;
+            if(metrics != nullptr){
+                const uint64_t now = Profiler::now();
+                Metrics::add(metrics->keys_ns, now - mark);
+                mark = now;
             }
             
-            long us = pow(10, 6) / clock_hertz;
-            std::this_thread::sleep_for(std::chrono::microseconds(us));
+            const bool turbo = turbo_always || frontend.fast_forward();
+            const double frame_speed = turbo ? turbo_speed : speed;
+            const bool paced = frontend.throttled() && frame_speed > 0;
             
-            auto end = std::chrono::steady_clock::now();
+            if(rewind != nullptr && frontend.rewinding()){
+                //one snapshot back per frame, so history plays backwards at the speed it was recorded
+                MachineState state;
+                if(rewind->step_back(state)){
+                    load_state(state, true);
+                }
+                frontend.update_sound(false);
+            }
+            else{
+                unsigned long cycles = frame_cycles(frame);
+                if(limit != 0 && cycles > limit - cycle_count){
+                    cycles = limit - cycle_count;
+                }
+                
+                pc = execute(cycles);
+                if(pc != -1){
+                    break;
+                }
+                
+                //a sound timer of n sounds for n whole frames, counting this one
+                frontend.update_sound(sound_timer > 0);
+                update_timers();
+                
+                if(rewind != nullptr){
+                    MachineState state;
+                    save_state(state);
+                    rewind->push(state);
+                }
+            }
             
-            elapsed_time += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            if(turbo){
+                frame_stats.turbo_frames++;
+            }
+            if(metrics != nullptr){
+                const uint64_t now = Profiler::now();
+                Metrics::add(metrics->interpret_ns, now - mark);
+                Metrics::add(metrics->instructions, cycle_count - frame_start_cycle);
+                //close enough to when the timers ticked, rewind snapshots are cheap
+                tick = now;
+                mark = now;
+            }
             
-            long max = (1 / 60.0) * pow(10, 9);
+            //while fast-forwarding only every turbo_frame_skip-th frame is shown, always a complete one
+            if(!turbo || ++skipped >= turbo_frame_skip){
+                skipped = 0;
+                const uint64_t display_start = profiler != nullptr ? Profiler::now() : 0;
+                frontend.update_display(display);
+                if(profiler != nullptr){
+                    profiler->add_time(Profiler::SECTION_DISPLAY, display_start);
+                }
+                frame_stats.presented++;
+                if(metrics != nullptr){
+                    const uint64_t now = Profiler::now();
+                    Metrics::add(metrics->display_ns, now - mark);
+                    Metrics::add(metrics->presented, 1);
+                    mark = now;
+                }
+            }
+            frame_stats.frames++;
+            
+            if(paced){
+                const clock::duration period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1 / (60 * frame_speed)));
+                //coming back from unlimited speed, start counting from now instead of racing to catch up
+                if(!was_paced){
+                    deadline = clock::now();
+                }
+                deadline += period;
+                //the frame's time slot ends at the new deadline, a tick after that came late
+                if(metrics != nullptr){
+                    const uint64_t slot_end = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+                    metrics->timer_lag_ns.store(tick > slot_end ? tick - slot_end : 0, std::memory_order_relaxed);
+                }
+                std::this_thread::sleep_until(deadline - spin);
+                while(clock::now() < deadline){
+                    std::this_thread::yield();
+                }
+                
+                const clock::time_point woke = clock::now();
+                const double late_us = std::chrono::duration<double, std::micro>(woke - deadline).count();
+                total_late_us += late_us;
+                paced_frames++;
+                if(late_us > frame_stats.jitter_max_us){
+                    frame_stats.jitter_max_us = late_us;
+                }
+                if(metrics != nullptr){
+                    Metrics::add(metrics->overshoot_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(woke - deadline).count());
+                    Metrics::add(metrics->paced_frames, 1);
+                }
+                
+                //after a long stall (a debugger, a dragged window) start over from now rather than racing to catch up
+                if(woke - deadline > 15 * period){
+                    deadline = woke;
+                }
+            }
+            was_paced = paced;
             
-            if(elapsed_time > max){
-                while(elapsed_time > max){
-                    elapsed_time -= max;
-                    update_timers();
+            //unpaced frames have nothing to wait for, the little left of them goes to the next frame's keys
+            if(metrics != nullptr){
+                if(paced){
+                    const uint64_t now = Profiler::now();
+                    Metrics::add(metrics->sleep_ns, now - mark);
+                    mark = now;
                 }
+                Metrics::add(metrics->frames, 1);
+                metrics->dropped.store(frontend.dropped_frames(), std::memory_order_relaxed);
             }
         }
         
-        clean_up_display();
-        
-        if(pc != -1){
-            std::stringstream stream;
-            unsigned short opcode = (memory[pc] << 8) | memory[pc + 1];
-            stream << "Error: Opcode " << std::hex << opcode << " at memory address " << pc << " is invalid.";
-            return stream.str();
+        frame_stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if(frame_stats.seconds > 0){
+            frame_stats.effective_hertz = cycle_count / frame_stats.seconds;
         }
-        else{
-            return "Window terminated by user.";
+        if(paced_frames > 0){
+            frame_stats.jitter_mean_us = total_late_us / paced_frames;
         }
+        return pc;
     }
     
     void Chip::init_cpu(){
@@ -83,45 +535,112 @@ namespace chip{
             memory[i] = font_set[i];
         }
         
+        invalidate_all();
+        
         I = 0x0;
         pc = 0x200;
         stack_ptr = 0;
         delay_timer = 0;
         sound_timer = 0;
+        cycle_count = 0;
+        random_state = seed;
+        exit_reason = EXIT_NONE;
         
         for(int i = 0; i < 16; i++){
             v[i] = 0;
             stack[i] = 0;
-            keys[i] = 0;
         }
+        keys.store(0, std::memory_order_relaxed);
     }
     
     bool Chip::load_game(std::string fileName){
-        std::ifstream f(fileName); //taking file as inputstream
-        std::string str;
+        std::ifstream f(fileName, std::ios::binary);
         if(!f) {
             return false;
         }
         
-        std::ostringstream ss;
-        ss << f.rdbuf(); // reading data
-        str = ss.str();
-        
-        if(str.length() > 0x1000 - 0x200){
+        //one byte more than fits, so a ROM that is too big still reads as too big
+        unsigned char rom[0x1000 - 0x200 + 1];
+        f.read(reinterpret_cast<char*>(rom), sizeof(rom));
+        return load_game(rom, f.gcount());
+    }
+    
+    bool Chip::load_game(const unsigned char* rom, size_t size){
+        if(size > 0x1000 - 0x200){
             return false;
         }
         
-        for(int i = 0; i < str.length(); i++){
-            memory[i + 0x200] = str[i];
+        for(size_t i = 0; i < size; i++){
+            memory[i + 0x200] = rom[i];
         }
         
+        invalidate_all();
         return true;
     }
     
-    int Chip::execute_cycle(){
-        //fetch opcode
-        const unsigned short opcode = (memory[pc] << 8) | memory[pc + 1]; //each opcode is 2 bytes, so merge two ajdacent spots in memory
-        
+    //descriptions returned by describe, indexed by Op
+    static const char* const descriptions[Chip::OP_COUNT] = {
+        "undecoded.",
+        "Clear the display.",
+        "The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.",
+        "The interpreter sets the program counter to nnn.",
+        "The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.",
+        "The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.",
+        "The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.",
+        "The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.",
+        "The interpreter puts the value kk into register Vx.",
+        "Adds the value kk to the value of register Vx, then stores the result in Vx.",
+        "Stores the value of register Vy in register Vx.",
+        "Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in the result is also 1. Otherwise, it is 0.",
+        "Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in the result is also 1. Otherwise, it is 0.",
+        "Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.",
+        "The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.",
+        "If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.",
+        "If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.",
+        "If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.",
+        "If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.",
+        "The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.",
+        "The value of register I is set to nnn.",
+        "The program counter is set to nnn plus the value of V0.",
+        "The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.",
+        "The interpreter reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites on screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels to be erased, VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is outside the coordinates of the display, it wraps around to the opposite side of the screen. See instruction 8xy3 for more information on XOR, and section 2.4, Display, for more information on the Chip-8 screen and sprites.",
+        "Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.",
+        "Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.",
+        "The value of DT is placed into Vx.",
+        "All execution stops until a key is pressed, then the value of that key is stored in Vx.",
+        "DT is set equal to the value of Vx.",
+        "ST is set equal to the value of Vx.",
+        "The values of I and Vx are added, and the results are stored in I.",
+        "The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.",
+        "The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.",
+        "The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.",
+        "The interpreter reads values from memory starting at location I into registers V0 through Vx.",
+        "unsupported opcode.",
+        "Annn then Fx65: I is set to nnn, then registers V0 through Vx are read from memory starting at I.",
+        "Annn then Fx55: I is set to nnn, then registers V0 through Vx are copied into memory starting at I.",
+        "Annn then Fx1E: I is set to nnn, then Vx is added to I.",
+        "6xkk then 6ykk: two registers are loaded with constants.",
+        "3xkk then 1nnn: unless Vx equals kk, the program counter is set to nnn.",
+        "4xkk then 1nnn: if Vx equals kk, the program counter is set to nnn.",
+        "breakpoint."
+    };
+    
+    //opcode patterns returned by mnemonic, indexed by Op
+    static const char* const mnemonics[Chip::OP_COUNT] = {
+        "decode",
+        "00E0", "00EE", "1nnn", "2nnn",
+        "3xkk", "4xkk", "5xy0", "6xkk", "7xkk",
+        "8xy0", "8xy1", "8xy2", "8xy3", "8xy4",
+        "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+        "Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E",
+        "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18",
+        "Fx1E", "Fx29", "Fx33", "Fx55", "Fx65",
+        "invalid",
+        "Annn+Fx65", "Annn+Fx55", "Annn+Fx1E", "6xkk+6xkk", "3xkk+1nnn", "4xkk+1nnn",
+        "break"
+    };
+    
+    Chip::Instruction Chip::decode(unsigned short opcode){
         //TODO: use unions, since this is the same piece of memory
         const unsigned char instruction = (opcode & 0xF000) >> 12;
         const unsigned short nnn = opcode & 0x0FFF;
@@ -130,455 +649,688 @@ namespace chip{
         const unsigned char y = (opcode & 0x00F0) >> 4;
         const unsigned char kk = opcode & 0x00FF;
         
-        std::string to_print;
+        Instruction ins;
+        ins.x = x;
+        ins.y = y;
+        ins.kk = kk;
+        ins.nnn = nnn;
+        ins.op = OP_INVALID;
+        
         switch(instruction){
-            case 0x0: {
-                switch(nnn){
-                    case 0x0E0:{
-                        to_print = "Clear the display.";
-                        clear_display();
-                        break;
-                    }
-                        
-                    case 0x0EE:{
-                        to_print = "The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.";
-                        
-                        pc = stack[stack_ptr];
-                        stack_ptr--;
-                        
-                        break;
-                    }
-                        
-                    default:{
-                        to_print = "unsupported opcode.";
-                        return pc;
-                    }
-                }
-                break;
-            }
-                
-            case 0x1:{
-                to_print = "The interpreter sets the program counter to nnn.";
-                pc = nnn - 2;
-                break;
-            }
-                
-            case 0x2:{
-                to_print = "The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.";
-                stack_ptr++;
-                stack[stack_ptr] = pc;
-                pc = nnn - 2;
-                break;
-            }
-                
-            case 0x3:{
-                to_print = "The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.";
-                if(v[x] == kk){
-                    pc += 2;
+            case 0x0:{
+                if(nnn == 0x0E0){
+                    ins.op = OP_CLS;
                 }
-                break;
-            }
-                
-            case 0x4:{
-                to_print = "The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.";
-                if(v[x] != kk){
-                    pc += 2;
+                else if(nnn == 0x0EE){
+                    ins.op = OP_RET;
                 }
                 break;
             }
-                
-            case 0x5:{
-                to_print = "The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.";
-                if(v[x] == v[y]){
-                    pc += 2;
-                }
-                break;
-            }
-                
-            case 0x6:{
-                to_print = "The interpreter puts the value kk into register Vx.";
-                v[x] = kk;
-                break;
-            }
-                
-            case 0x7:{
-                to_print = "Adds the value kk to the value of register Vx, then stores the result in Vx.";
-                v[x] += kk;
-                break;
-            }
-                
+            case 0x1: ins.op = OP_JP; break;
+            case 0x2: ins.op = OP_CALL; break;
+            case 0x3: ins.op = OP_SE_VX_KK; break;
+            case 0x4: ins.op = OP_SNE_VX_KK; break;
+            case 0x5: ins.op = OP_SE_VX_VY; break;
+            case 0x6: ins.op = OP_LD_VX_KK; break;
+            case 0x7: ins.op = OP_ADD_VX_KK; break;
             case 0x8:{
                 switch(n){
-                    case 0x0:{
-                        to_print = "Stores the value of register Vy in register Vx.";
-                        v[x] = v[y];
-                        break;
-                    }
-                        
-                    case 0x1:{
-                        to_print = "Performs a bitwise OR on the values of Vx and Vy, then stores the result in Vx. A bitwise OR compares the corrseponding bits from two values, and if either bit is 1, then the same bit in the result is also 1. Otherwise, it is 0.";
-                        v[x] |= v[y];
-                        break;
-                    }
-                        
-                    case 0x2:{
-                        to_print = "Performs a bitwise AND on the values of Vx and Vy, then stores the result in Vx. A bitwise AND compares the corrseponding bits from two values, and if both bits are 1, then the same bit in the result is also 1. Otherwise, it is 0.";
-                        v[x] &= v[y];
-                        break;
-                    }
-                        
-                    case 0x3:{
-                        to_print = "Performs a bitwise exclusive OR on the values of Vx and Vy, then stores the result in Vx. An exclusive OR compares the corrseponding bits from two values, and if the bits are not both the same, then the corresponding bit in the result is set to 1. Otherwise, it is 0.";
-                        v[x] ^= v[y];
-                        break;
-                    }
-                        
-                    case 0x4:{
-                        to_print = "The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.";
-                        unsigned int ans = v[x] + v[y];
-                        if(ans > 0xFF){
-                            v[0xF] = 1;
-                            //v[x] = ans - 0xFF - 1;
-                        }
-                        else{
-                            v[0xF] = 0;
-                            //  v[x] = ans;
-                        }
-                        
-                        v[x] = ans;
-                        break;
-                    }
-                        
-                    case 0x5:{
-                        to_print = "If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.";
-                        if(v[x] > v[y]){
-                            v[0xF] = 1;
-                            //  v[x] = 0;
-                        }
-                        else{
-                            v[0xF] = 0;
-                            //  v[x] -= v[y];
-                        }
-                        v[x] -= v[y];
-                        
-                        break;
-                    }
-                        
-                    case 0x6:{
-                        to_print = "If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.";
-                        if(v[x] % 2 == 1){
-                            v[0xF] = 1;
-                        }
-                        else{
-                            v[0xF] = 0;
-                        }
-                        
-                        v[x] /= 2;
-                        break;
-                    }
-                        
-                    case 0x7:{
-                        to_print = "If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.";
-                        if(v[y] > v[x]){
-                            v[0xF] = 1;
-                        }
-                        else{
-                            v[0xF] = 0;
-                        }
-                        v[x] = v[y] - v[x];
-                        break;
-                    }
-                        
-                    case 0xE:{
-                        to_print = "If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.";
-                        if(v[x] >= 0x80){
-                            v[0xF] = 1;
-                        }
-                        else{
-                            v[0xF] = 0;
-                        }
-                        v[x] *= 2;
-                        break;
-                    }
-                        
-                    default:{
-                        to_print = "unsupported opcode.";
-                        return pc;
-                    }
-                }
-                break;
-            }
-                
-            case 0x9:{
-                to_print = "The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.";
-                if(v[x] != v[y]){
-                    pc += 2;
-                }
-                break;
-            }
-                
-            case 0xA:{
-                to_print = "The value of register I is set to nnn.";
-                I = nnn;
-                break;
-            }
-                
-            case 0xB:{
-                to_print = "The program counter is set to nnn plus the value of V0.";
-                pc = nnn + v[0] - 2;
-                break;
-            }
-                
-            case 0xC:{
-                to_print = "The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.";
-                unsigned char rand = std::rand() % 255;
-                v[x] = kk & rand;
-                break;
-            }
-                
-            case 0xD:{
-                to_print = "The interpreter reads n bytes from memory, starting at the address stored in I. These bytes are then displayed as sprites on screen at coordinates (Vx, Vy). Sprites are XORed onto the existing screen. If this causes any pixels to be erased, VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it is outside the coordinates of the display, it wraps around to the opposite side of the screen. See instruction 8xy3 for more information on XOR, and section 2.4, Display, for more information on the Chip-8 screen and sprites.";
-                
-                v[0xF] = 0;
-                
-                const unsigned char s_x = v[x];
-                
-                for(int i = 0; i < n; i++){
-                    unsigned char val = memory[I + i];
-                    
-                    unsigned char x_coord = s_x;
-                    unsigned char y_coord = (v[y] + i) % 32;
-                    
-                    for(int j = 0; j < 8; j++){
-                        bool pixel = val & 0x80;
-                        
-                        if(display[x_coord + 64 * y_coord] & pixel){
-                            v[0xF] = 1;
-                        }
-                        display[x_coord + 64 * y_coord] ^= pixel;
-                        
-                        val <<= 1;
-                        
-                        x_coord = (x_coord + 1) % 64;
-                    }
+                    case 0x0: ins.op = OP_LD_VX_VY; break;
+                    case 0x1: ins.op = OP_OR; break;
+                    case 0x2: ins.op = OP_AND; break;
+                    case 0x3: ins.op = OP_XOR; break;
+                    case 0x4: ins.op = OP_ADD_VX_VY; break;
+                    case 0x5: ins.op = OP_SUB; break;
+                    case 0x6: ins.op = OP_SHR; break;
+                    case 0x7: ins.op = OP_SUBN; break;
+                    case 0xE: ins.op = OP_SHL; break;
                 }
-                
-                update_display();
-                
                 break;
             }
-                
+            case 0x9: ins.op = OP_SNE_VX_VY; break;
+            case 0xA: ins.op = OP_LD_I; break;
+            case 0xB: ins.op = OP_JP_V0; break;
+            case 0xC: ins.op = OP_RND; break;
+            case 0xD: ins.op = OP_DRW; break;
             case 0xE:{
                 switch(kk){
-                    case 0x9E:{
-                        to_print = "Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.";
-                        if(keys[v[x]]){
-                            pc += 2;
-                        }
-                        break;
-                    }
-                        
-                    case 0xA1:{
-                        to_print = "Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.";
-                        if(!keys[v[x]]){
-                            pc += 2;
-                        }
-                        break;
-                    }
-                        
-                    default:{
-                        to_print = "unsupported opcode.";
-                        return pc;
-                    }
+                    case 0x9E: ins.op = OP_SKP; break;
+                    case 0xA1: ins.op = OP_SKNP; break;
                 }
                 break;
             }
-                
             case 0xF:{
                 switch(kk){
-                    case 0x07:{
-                        to_print = "The value of DT is placed into Vx.";
-                        v[x] = delay_timer;
-                        break;
-                    }
-                        
-                    case 0x0A:{
-                        to_print = "All execution stops until a key is pressed, then the value of that key is stored in Vx.";
-                        bool pressed = false;
-                        int i;
-                        for(i = 0; i < sizeof(keys); i++){
-                            if(keys[i]){
-                                pressed = true;
-                                break;
-                            }
-                        }
-                        if(!pressed){
-                            pc -= 2;
-                        }
-                        else{
-                            v[x] = i;
-                        }
-                        break;
-                    }
-                        
-                    case 0x15:{
-                        to_print = "DT is set equal to the value of Vx.";
-                        delay_timer = v[x];
-                        break;
-                    }
-                        
-                    case 0x18:{
-                        to_print = "ST is set equal to the value of Vx.";
-                        sound_timer = v[x];
-                        break;
-                    }
-                        
-                    case 0x1E:{
-                        to_print = "The values of I and Vx are added, and the results are stored in I.";
-                        I += v[x];
-                        break;
-                    }
-                        
-                    case 0x29:{
-                        to_print = "The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.";
-                        
-                        I = v[x] * 5;
-                        break;
-                    }
-                        
-                    case 0x33:{
-                        to_print = "The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.";
-                        
-                        memory[I] = v[x] / 100;
-                        memory[I + 1] = (v[x] / 10) % 10;
-                        memory[I + 2] = v[x] % 10;
-                        break;
-                    }
-                        
-                    case 0x55:{
-                        to_print = "The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.";
-                        for(int i = 0; i <= x; i++){
-                            memory[I + i] = v[i];
-                        }
-                        break;
-                    }
-                        
-                    case 0x65:{
-                        to_print = "The interpreter reads values from memory starting at location I into registers V0 through Vx.";
-                        for(int i = 0; i <= x; i++){
-                            v[i] = memory[I + i];
-                        }
-                        break;
-                    }
-                        
-                    default:{
-                        to_print = "unsupported opcode.";
-                        return pc;
-                    }
+                    case 0x07: ins.op = OP_LD_VX_DT; break;
+                    case 0x0A: ins.op = OP_LD_VX_K; break;
+                    case 0x15: ins.op = OP_LD_DT_VX; break;
+                    case 0x18: ins.op = OP_LD_ST_VX; break;
+                    case 0x1E: ins.op = OP_ADD_I_VX; break;
+                    case 0x29: ins.op = OP_LD_F_VX; break;
+                    case 0x33: ins.op = OP_LD_B_VX; break;
+                    case 0x55: ins.op = OP_LD_I_VX; break;
+                    case 0x65: ins.op = OP_LD_VX_I; break;
                 }
                 break;
             }
-                
-            default:{
-                to_print = "unsupported opcode.";
-                return pc;
-            }
         }
         
-#if PRINT_OPCODES == 1
-        std::cout << std::hex << opcode << " " << to_print << std::endl;
-#endif
-        
-        pc += 2;
-        return -1;
+        return ins;
     }
     
-    void Chip::update_timers(){
-        if(delay_timer > 0){
-            delay_timer--;
+    Chip::Instruction Chip::fuse(Instruction first, Instruction second){
+        Instruction ins = first;
+        if(first.op == OP_LD_I){
+            ins.x = second.x;
+            switch(second.op){
+                case OP_LD_VX_I: ins.op = OP_LD_I_LD_VX_I; return ins;
+                case OP_LD_I_VX: ins.op = OP_LD_I_LD_I_VX; return ins;
+                case OP_ADD_I_VX: ins.op = OP_LD_I_ADD_I_VX; return ins;
+            }
         }
-        if(sound_timer > 0){
-            sound_timer--;
+        else if(first.op == OP_LD_VX_KK && second.op == OP_LD_VX_KK){
+            ins.op = OP_LD_VX_KK_LD_VX_KK;
+            ins.y = second.x;
+            ins.nnn = second.kk;
+            return ins;
+        }
+        else if((first.op == OP_SE_VX_KK || first.op == OP_SNE_VX_KK) && second.op == OP_JP){
+            ins.op = first.op == OP_SE_VX_KK ? OP_SE_VX_KK_JP : OP_SNE_VX_KK_JP;
+            ins.nnn = second.nnn;
+            return ins;
         }
+        return first;
+    }
+    
+    const char* Chip::describe(unsigned short opcode){
+        return descriptions[decode(opcode).op];
     }
     
+    const char* Chip::mnemonic(unsigned char op){
+        return op < OP_COUNT ? mnemonics[op] : "?";
+    }
     
-    bool Chip::init_display(){
-        clear_display();
-        
-        SDL_Init(SDL_INIT_EVERYTHING);
-        window = SDL_CreateWindow("Chip8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 64 * pixel_size, 32 * pixel_size, SDL_WINDOW_SHOWN);
-        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-        
-        if(!(window || renderer)){
-            return false;
+    unsigned short Chip::fetch(unsigned short address) const{
+        //each opcode is 2 bytes, so merge two ajdacent spots in memory
+        return (memory[address & 0xFFF] << 8) | memory[(address + 1) & 0xFFF];
+    }
+    
+    void Chip::invalidate(unsigned short address){
+        //the instruction starting one byte earlier also contains this byte, and fused pairs reach up to three bytes back
+        for(int i = 0; i < 4; i++){
+            decoded[(address - i) & 0xFFF].op = OP_DECODE;
         }
+        dirty_pages |= 1u << ((address & 0xFFF) / Fork::page_size);
         
-        return true;
+        if(jit != nullptr){
+            jit->invalidate(address);
+        }
     }
     
-    void Chip::clear_display(){
-        for(int i = 0; i < sizeof(display); i++){
-            display[i] = false;
+    void Chip::invalidate_all(){
+        for(int i = 0; i < 4096; i++){
+            decoded[i].op = OP_DECODE;
+        }
+        dirty_pages = ~0u;
+        
+        if(jit != nullptr){
+            jit->flush();
         }
     }
     
-    bool Chip::update_keys(){
-        SDL_Event e;
-        if(SDL_PollEvent(&e)){
-            if (e.type == SDL_QUIT){
-                return false;
+    int Chip::execute(unsigned long count){
+        watch_hit = -1;
+        const bool debugging = breakpoint_count != 0 || watchpoint_count != 0;
+        return jit != nullptr && tracer == nullptr && profiler == nullptr && !debugging && quirks == QUIRKS_CHIP8 ? execute_jit(count) : execute_cycles(count);
+    }
+    
+    //runs translated blocks while they fit in the remaining cycles, and the interpreter for everything else
+    int Chip::execute_jit(unsigned long count){
+        while(count > 0){
+            unsigned int length;
+            Jit::Block block = jit->lookup(pc, memory, length);
+            
+            if(block != nullptr && length <= count){
+                block(v, memory, &I, &pc, &delay_timer, &sound_timer);
+                cycle_count += length;
+                count -= length;
             }
-            else if(e.type == SDL_KEYDOWN){
-                for(int i = 0; i < sizeof(keys); i++){
-                    if(e.key.keysym.sym == keycodes[i]){
-                        keys[i] = 1;
-                    }
+            else{
+                int error = execute_cycles(1);
+                if(error != -1){
+                    return error;
                 }
+                count--;
             }
-            else if(e.type == SDL_KEYUP){
-                for(int i = 0; i < sizeof(keys); i++){
-                    if(e.key.keysym.sym == keycodes[i]){
-                        keys[i] = 0;
-                    }
-                }
+        }
+        return -1;
+    }
+    
+    void Chip::trace(unsigned long cycle){
+        //decoded afresh, the cache entry may be a fused pair with other operands
+        const Instruction ins = decode(fetch(pc));
+        TraceRecord r;
+        r.cycle = cycle;
+        r.pc = pc;
+        r.opcode = fetch(pc);
+        r.I = I;
+        r.vx = v[ins.x];
+        r.vy = v[ins.y];
+        tracer->record(r);
+    }
+    
+    int Chip::execute_cycle(){
+        return execute_cycles(1);
+    }
+
+//computed goto is a GCC/Clang extension, everything else gets a plain switch
+#if defined(__GNUC__)
+#define THREADED_DISPATCH 1
+#else
+#define THREADED_DISPATCH 0
+#endif
+
+//one predictable branch per instruction while no tracer is attached, nothing at all with CHIP_TRACE set to 0
+#if CHIP_TRACE
+#define TRACE() if(tracing && ins->op != OP_DECODE && ins->op != OP_BREAK){ trace(cycle_count + (count - remaining - 1)); }
+#define TRACE_SECOND() if(tracing){ trace(cycle_count + (count - remaining - 1)); }
+#else
+#define TRACE()
+#define TRACE_SECOND()
+#endif
+
+//anything that changes the machine beyond V0-VF, I and the stack pointer, see the idle loop check in OP_JP
+#define EFFECT() effects++
+//after a write to memory: if a watchpoint is on address, the burst ends once the current instruction is done and
+//watch_hit holds the first watched address it wrote. One branch on a local in the store handlers while nothing is watched
+#define WATCH(address) if(watching && watchpoints[(address) & 0xFFF]){ \
+    watch_hit = watch_hit != -1 ? watch_hit : (address) & 0xFFF; count -= remaining; remaining = 0; }
+//moves on to the second instruction of a fused pair, which is a cycle of its own and may not fit in the burst: then the
+//pair is left half done and the entry for the second instruction picks up from there
+#define SECOND() if(remaining == 0){ NEXT(); } remaining--; pc += 2; fused++; TRACE_SECOND()
+
+#if THREADED_DISPATCH
+#define HANDLER(op) handle_##op
+#define DISPATCH() if(remaining == 0){ goto done; } remaining--; ins = &decoded[pc & 0xFFF]; TRACE(); goto *handlers[ins->op]
+#define NEXT() pc += 2; DISPATCH()
+#define JUMP() DISPATCH()
+#else
+#define HANDLER(op) case op
+#define DISPATCH() if(remaining == 0){ goto done; } remaining--; ins = &decoded[pc & 0xFFF]; TRACE()
+#define NEXT() pc += 2; continue
+#define JUMP() continue
+#endif
+    
+    //runs up to count instructions from the decoded cache, returns -1 or the address of an invalid opcode
+    int Chip::execute_cycles(unsigned long count){
+        if(profiler == nullptr){
+            return (this->*interpreters[0])(count);
+        }
+        
+        //profiled bursts run in stretches with a sample before each, so the interpreter has no per-instruction counting
+        //to do. A stretch that ran short stopped the burst (an invalid opcode, a breakpoint or a watchpoint)
+        while(true){
+            if(profiler->sample_due()){
+                //the pair is fused from memory as OP_DECODE would, the cache entry may not be decoded yet
+                const Instruction first = decode(fetch(pc));
+                const bool breakpoint = breakpoint_count != 0 && breakpoints[(pc + 2) & 0xFFF];
+                const unsigned char fused = breakpoint ? first.op : fuse(first, decode(fetch(pc + 2))).op;
+                profiler->sample(pc, first.op, fused != first.op ? fused : 0, stack, stack_ptr, memory);
+            }
+            const unsigned long stretch = std::min(count, profiler->until_sample());
+            const unsigned long start = cycle_count;
+            const int stop = (this->*interpreters[1])(stretch);
+            const unsigned long ran = cycle_count - start;
+            profiler->ran(ran);
+            count -= ran;
+            if(stop != -1 || ran < stretch || count == 0){
+                return stop;
             }
         }
-        return true;
     }
     
-    void Chip::update_display(){
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-        
-        int rows = 32; int cols = 64;
-        for(int i = 0; i < rows; i++){
-            for(int j = 0; j < cols; j++){
-                if(display[j + cols * i]){
-                    SDL_Rect rect;
-                    rect.x = j * pixel_size;
-                    rect.y = i * pixel_size;
-                    rect.w = pixel_size;
-                    rect.h = pixel_size;
-                    
-                    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                    SDL_RenderFillRect(renderer, &rect);
+    template<typename Quirks, bool profiling> int Chip::interpret(unsigned long count){
+        const Instruction* ins;
+        unsigned long remaining = count;
+        const bool tracing = tracer != nullptr;
+        const bool watching = watchpoint_count != 0;
+        
+        //idle loop detection: the state at the last backward jump, and how many effects had happened by then.
+        //Skipping is off while tracing or profiling, those have to see every instruction
+        const bool skip_idle = !tracing && !profiling;
+        unsigned long effects = 0;
+        unsigned long loop_effects = 0;
+        unsigned short loop_target = 0xFFFF;
+        unsigned long loop_at = 0;
+        unsigned char loop_v[16];
+        unsigned short loop_I = 0;
+        unsigned char loop_stack_ptr = 0;
+        
+        //pairs that ran both halves, added to frame_stats on the way out
+        unsigned long fused = 0;
+
+#if THREADED_DISPATCH
+        static void* const handlers[OP_COUNT] = {
+            &&handle_OP_DECODE, &&handle_OP_CLS, &&handle_OP_RET, &&handle_OP_JP, &&handle_OP_CALL,
+            &&handle_OP_SE_VX_KK, &&handle_OP_SNE_VX_KK, &&handle_OP_SE_VX_VY, &&handle_OP_LD_VX_KK, &&handle_OP_ADD_VX_KK,
+            &&handle_OP_LD_VX_VY, &&handle_OP_OR, &&handle_OP_AND, &&handle_OP_XOR, &&handle_OP_ADD_VX_VY,
+            &&handle_OP_SUB, &&handle_OP_SHR, &&handle_OP_SUBN, &&handle_OP_SHL, &&handle_OP_SNE_VX_VY,
+            &&handle_OP_LD_I, &&handle_OP_JP_V0, &&handle_OP_RND, &&handle_OP_DRW, &&handle_OP_SKP,
+            &&handle_OP_SKNP, &&handle_OP_LD_VX_DT, &&handle_OP_LD_VX_K, &&handle_OP_LD_DT_VX, &&handle_OP_LD_ST_VX,
+            &&handle_OP_ADD_I_VX, &&handle_OP_LD_F_VX, &&handle_OP_LD_B_VX, &&handle_OP_LD_I_VX, &&handle_OP_LD_VX_I,
+            &&handle_OP_INVALID,
+            &&handle_OP_LD_I_LD_VX_I, &&handle_OP_LD_I_LD_I_VX, &&handle_OP_LD_I_ADD_I_VX, &&handle_OP_LD_VX_KK_LD_VX_KK,
+            &&handle_OP_SE_VX_KK_JP, &&handle_OP_SNE_VX_KK_JP,
+            &&handle_OP_BREAK
+        };
+        
+        DISPATCH();
+#else
+        while(true){
+            DISPATCH();
+            switch(ins->op){
+#endif
+        
+        HANDLER(OP_DECODE):{
+            //decoding is free: it does not count as a cycle
+            const Instruction first = decode(fetch(pc));
+            decoded[pc & 0xFFF] = first;
+            //only these can start a fused pair, self-modifying code re-decodes often enough for the second decode to show.
+            //A pair never swallows a breakpoint on its second instruction
+            const bool pairs = first.op == OP_LD_I || first.op == OP_LD_VX_KK || first.op == OP_SE_VX_KK || first.op == OP_SNE_VX_KK;
+            if(pairs && !(breakpoint_count != 0 && breakpoints[(pc + 2) & 0xFFF])){
+                const Instruction second = decode(fetch(pc + 2));
+                decoded[pc & 0xFFF] = fuse(first, second);
+            }
+            if(breakpoint_count != 0 && breakpoints[pc & 0xFFF]){
+                decoded[pc & 0xFFF].op = OP_BREAK;
+            }
+            remaining++;
+            JUMP();
+        }
+        
+        HANDLER(OP_CLS):{
+            EFFECT();
+            display.clear();
+            NEXT();
+        }
+        
+        HANDLER(OP_RET):{
+            pc = stack[stack_ptr];
+            stack_ptr--;
+            NEXT();
+        }
+        
+        HANDLER(OP_JP):{
+        jump_nnn:
+            if(profiling && ins->nnn <= pc){
+                profiler->backward_branch(pc, ins->nnn);
+            }
+            if(skip_idle && ins->nnn <= pc){
+                if(ins->nnn == loop_target && effects == loop_effects && I == loop_I && stack_ptr == loop_stack_ptr && memcmp(v, loop_v, sizeof(v)) == 0){
+                    //a whole iteration left the machine exactly as it found it. Timers and keys only change between
+                    //bursts, so every iteration until then is the same one: skip as many as fit, run the rest normally
+                    const unsigned long length = (count - remaining) - loop_at;
+                    const unsigned long skipped = remaining / length * length;
+                    remaining -= skipped;
+                    frame_stats.idle_cycles += skipped;
                 }
+                loop_target = ins->nnn;
+                loop_at = count - remaining;
+                loop_effects = effects;
+                loop_I = I;
+                loop_stack_ptr = stack_ptr;
+                memcpy(loop_v, v, sizeof(v));
             }
+            pc = ins->nnn;
+            JUMP();
         }
         
-        SDL_RenderPresent(renderer);
+        HANDLER(OP_CALL):{
+            stack_ptr++;
+            stack[stack_ptr] = pc;
+            pc = ins->nnn;
+            JUMP();
+        }
+        
+        HANDLER(OP_SE_VX_KK):{
+            if(v[ins->x] == ins->kk){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_SNE_VX_KK):{
+            if(v[ins->x] != ins->kk){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_SE_VX_VY):{
+            if(v[ins->x] == v[ins->y]){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_VX_KK):{
+            v[ins->x] = ins->kk;
+            NEXT();
+        }
+        
+        HANDLER(OP_ADD_VX_KK):{
+            v[ins->x] += ins->kk;
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_VX_VY):{
+            v[ins->x] = v[ins->y];
+            NEXT();
+        }
+        
+        HANDLER(OP_OR):{
+            v[ins->x] |= v[ins->y];
+            NEXT();
+        }
+        
+        HANDLER(OP_AND):{
+            v[ins->x] &= v[ins->y];
+            NEXT();
+        }
+        
+        HANDLER(OP_XOR):{
+            v[ins->x] ^= v[ins->y];
+            NEXT();
+        }
+        
+        HANDLER(OP_ADD_VX_VY):{
+            unsigned int ans = v[ins->x] + v[ins->y];
+            v[0xF] = ans > 0xFF;
+            v[ins->x] = ans;
+            NEXT();
+        }
+        
+        HANDLER(OP_SUB):{
+            v[0xF] = v[ins->x] > v[ins->y];
+            v[ins->x] -= v[ins->y];
+            NEXT();
+        }
+        
+        HANDLER(OP_SHR):{
+            if(Quirks::shift_vy){
+                //the flag is written last, so it wins when x is F
+                const unsigned char value = v[ins->y];
+                v[ins->x] = value >> 1;
+                v[0xF] = value & 1;
+                NEXT();
+            }
+            v[0xF] = v[ins->x] % 2 == 1;
+            v[ins->x] /= 2;
+            NEXT();
+        }
+        
+        HANDLER(OP_SUBN):{
+            v[0xF] = v[ins->y] > v[ins->x];
+            v[ins->x] = v[ins->y] - v[ins->x];
+            NEXT();
+        }
+        
+        HANDLER(OP_SHL):{
+            if(Quirks::shift_vy){
+                const unsigned char value = v[ins->y];
+                v[ins->x] = value << 1;
+                v[0xF] = value >> 7;
+                NEXT();
+            }
+            v[0xF] = v[ins->x] >= 0x80;
+            v[ins->x] *= 2;
+            NEXT();
+        }
+        
+        HANDLER(OP_SNE_VX_VY):{
+            if(v[ins->x] != v[ins->y]){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_I):{
+            I = ins->nnn;
+            NEXT();
+        }
+        
+        HANDLER(OP_JP_V0):{
+            const unsigned short target = ins->nnn + v[Quirks::jump_vx ? ins->x : 0];
+            if(profiling && target <= pc){
+                profiler->backward_branch(pc, target);
+            }
+            pc = target;
+            JUMP();
+        }
+        
+        HANDLER(OP_RND):{
+            EFFECT();
+            unsigned char rand = next_random(random_state) % 255;
+            v[ins->x] = ins->kk & rand;
+            NEXT();
+        }
+        
+        HANDLER(OP_DRW):{
+            EFFECT();
+            if(profiling && profiler->sample_draw()){
+                const uint64_t start = Profiler::now();
+                v[0xF] = Quirks::clip_sprites ? display.draw_clipped(v[ins->x], v[ins->y], memory, I, ins->kk & 0xF) : display.draw(v[ins->x], v[ins->y], memory, I, ins->kk & 0xF);
+                profiler->add_draw_time(start);
+                NEXT();
+            }
+            v[0xF] = Quirks::clip_sprites ? display.draw_clipped(v[ins->x], v[ins->y], memory, I, ins->kk & 0xF) : display.draw(v[ins->x], v[ins->y], memory, I, ins->kk & 0xF);
+            NEXT();
+        }
+        
+        HANDLER(OP_SKP):{
+            if((keys.load(std::memory_order_relaxed) >> (v[ins->x] & 0xF)) & 1){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_SKNP):{
+            if(!((keys.load(std::memory_order_relaxed) >> (v[ins->x] & 0xF)) & 1)){
+                pc += 2;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_VX_DT):{
+            v[ins->x] = delay_timer;
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_VX_K):{
+            const unsigned short held = keys.load(std::memory_order_relaxed);
+            if(held == 0){
+                //run this instruction again next cycle. No key can be pressed before the burst ends, so all of those
+                //cycles can be spent waiting right away
+                if(skip_idle){
+                    frame_stats.idle_cycles += remaining;
+                    remaining = 0;
+                }
+                JUMP();
+            }
+            //the lowest held key
+            int i = 0;
+            while(!((held >> i) & 1)){
+                i++;
+            }
+            v[ins->x] = i;
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_DT_VX):{
+            EFFECT();
+            delay_timer = v[ins->x];
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_ST_VX):{
+            EFFECT();
+            sound_timer = v[ins->x];
+            NEXT();
+        }
+        
+        HANDLER(OP_ADD_I_VX):{
+        add_i:
+            I += v[ins->x];
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_F_VX):{
+            I = v[ins->x] * 5;
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_B_VX):{
+            EFFECT();
+            const unsigned char value = v[ins->x];
+            memory[I & 0xFFF] = value / 100;
+            memory[(I + 1) & 0xFFF] = (value / 10) % 10;
+            memory[(I + 2) & 0xFFF] = value % 10;
+            invalidate(I);
+            invalidate(I + 1);
+            invalidate(I + 2);
+            WATCH(I);
+            WATCH(I + 1);
+            WATCH(I + 2);
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_I_VX):{
+        store_registers:
+            EFFECT();
+            for(int i = 0; i <= ins->x; i++){
+                memory[(I + i) & 0xFFF] = v[i];
+                invalidate(I + i);
+                WATCH(I + i);
+            }
+            if(Quirks::load_store_i){
+                I += ins->x + 1;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_LD_VX_I):{
+        load_registers:
+            for(int i = 0; i <= ins->x; i++){
+                v[i] = memory[(I + i) & 0xFFF];
+            }
+            if(Quirks::load_store_i){
+                I += ins->x + 1;
+            }
+            NEXT();
+        }
+        
+        HANDLER(OP_INVALID):{
+            //the invalid opcode was not executed, so it does not count
+            remaining++;
+            cycle_count += count - remaining;
+            frame_stats.fused_pairs += fused;
+            return pc;
+        }
+        
+        //fused pairs: the first half here, then SECOND and the plain handler of the second instruction
+        HANDLER(OP_LD_I_LD_VX_I):{
+            I = ins->nnn;
+            SECOND();
+            goto load_registers;
+        }
+        
+        HANDLER(OP_LD_I_LD_I_VX):{
+            I = ins->nnn;
+            SECOND();
+            goto store_registers;
+        }
+        
+        HANDLER(OP_LD_I_ADD_I_VX):{
+            I = ins->nnn;
+            SECOND();
+            goto add_i;
+        }
+        
+        HANDLER(OP_LD_VX_KK_LD_VX_KK):{
+            v[ins->x] = ins->kk;
+            SECOND();
+            v[ins->y] = ins->nnn;
+            NEXT();
+        }
+        
+        HANDLER(OP_SE_VX_KK_JP):{
+            if(v[ins->x] == ins->kk){
+                //the jump is skipped
+                pc += 4;
+                JUMP();
+            }
+            SECOND();
+            goto jump_nnn;
+        }
+        
+        HANDLER(OP_SNE_VX_KK_JP):{
+            if(v[ins->x] != ins->kk){
+                pc += 4;
+                JUMP();
+            }
+            SECOND();
+            goto jump_nnn;
+        }
+        
+        HANDLER(OP_BREAK):{
+            //stopped before the instruction, which does not count, like OP_INVALID
+            remaining++;
+            cycle_count += count - remaining;
+            frame_stats.fused_pairs += fused;
+            return pc;
+        }
+
+#if !THREADED_DISPATCH
+            }
+        }
+#endif
+    
+    done:
+        cycle_count += count;
+        frame_stats.fused_pairs += fused;
+        return -1;
     }
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef TRACE
+#undef TRACE_SECOND
+#undef EFFECT
+#undef SECOND
+#undef WATCH
     
-    void Chip::clean_up_display(){
-        SDL_DestroyWindow(window);
-        SDL_DestroyRenderer(renderer);
-        SDL_Quit();
+    //xorshift32, so that every machine has its own sequence and threads never share generator state
+    unsigned int Chip::next_random(unsigned int& state){
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state >> 8;
     }
     
-    void Chip::init_keyboard(){
-        for(int i = 0; i < sizeof(keys); i++){
-            keys[i] = 0;
+    void Chip::update_timers(){
+        if(delay_timer > 0){
+            delay_timer--;
+        }
+        if(sound_timer > 0){
+            sound_timer--;
         }
     }
+    
+    
+    void Chip::init_keyboard(){
+        keys.store(0, std::memory_order_relaxed);
+    }
 }
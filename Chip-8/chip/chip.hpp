@@ -4,40 +4,197 @@
 #include<iostream>
 #include<fstream>
 #include<sstream>
-#include<SDL2/SDL.h>
 #include<thread>
 #include<chrono>
+#include<cmath>
+#include<bitset>
+#include "frontend.hpp"
+#include "jit.hpp"
+#include "trace.hpp"
+#include "state.hpp"
+#include "fork.hpp"
+#include "quirks.hpp"
+#include "rewind.hpp"
+#include "profile.hpp"
+#include "metrics.hpp"
 
 namespace chip{
     class Chip{
-        
+    
     public:
-        Chip(int clock_hertz);
+        Chip(int clock_hertz, Frontend& frontend);
+        //for embedding with load, step and run_frame below; run then uses a headless frontend without limits
+        explicit Chip(int clock_hertz);
         ~Chip();
         std::string run(std::string game);
+        std::string run(const unsigned char* rom, size_t size);
+        //continue the machine in fork instead of starting a ROM, the resume state is not used
+        std::string run(const Fork& fork);
+        
+        enum ExitReason{
+            EXIT_NONE,
+            EXIT_QUIT,
+            EXIT_CYCLE_LIMIT,
+            EXIT_INVALID_OPCODE,
+            EXIT_LOAD_FAILED,
+            EXIT_INIT_FAILED,
+            EXIT_BREAKPOINT
+        };
+        ExitReason get_exit_reason() const { return exit_reason; }
+        
+        //embedding: drive the machine from the host's own loop instead of run. The frontend is not involved, the keys
+        //are whatever set_keys said last and the screen can be read through get_display at any time. Before the first
+        //load the machine is empty: stepping it stops at once on the invalid opcode 0000 at 0x200
+        //a fresh machine with rom at 0x200, false if it does not fit
+        bool load(const unsigned char* rom, size_t size);
+        //up to count instructions without ticking the timers, returns -1 or the address of an invalid opcode
+        int step(unsigned long count);
+        //one 60 Hz frame as run does it (clock_hertz / 60 instructions, then one timer tick), returns like step.
+        //With a limit at most that many instructions of the frame run; a frame cut short by the limit, a breakpoint
+        //or a watchpoint continues on the next call and the timers tick once it is complete
+        int run_frame(unsigned long limit = ~0ul);
+        void set_keys(unsigned short mask){ keys.store(mask, std::memory_order_relaxed); }
+        //frames completed by run_frame since load
+        unsigned long get_frames() const { return host_frames; }
+        //true if the beeper sounded during the last run_frame
+        bool get_sound() const { return sounding; }
+        
+        //debugging: a breakpoint is patched into the decoded cache in place of its instruction, so execution stops there
+        //(the instruction not run, the address returned like an invalid opcode) without any other address paying for it.
+        //A watchpoint stops execution right after an Fx33 or Fx55 wrote to its address. The JIT is bypassed while any
+        //are set
+        void set_breakpoint(unsigned short address, bool on);
+        bool has_breakpoint(unsigned short address) const { return breakpoints[address & 0xFFF]; }
+        void set_watchpoint(unsigned short address, bool on);
+        bool has_watchpoint(unsigned short address) const { return watchpoints[address & 0xFFF]; }
+        //the first watched address written by the instruction the last execution stopped after, -1 if it did not stop
+        //for a watchpoint
+        int get_watch_hit() const { return watch_hit; }
+        
+        //translate hot code to native code where the host supports it, returns false if it does not
+        bool enable_jit();
+        
+        //record every executed instruction into tracer (null stops tracing), the JIT is bypassed while tracing
+        void set_tracer(Tracer* tracer){ this->tracer = tracer; }
+        
+        //count where the ROM spends its instructions and host time into profiler (null stops profiling), the JIT is
+        //bypassed while profiling
+        void set_profiler(Profiler* profiler){ this->profiler = profiler; }
+        
+        //keep running totals of throughput and of where run's host time goes in metrics (null stops), updated once per
+        //frame so the interpreter itself is untouched and the JIT stays on
+        void set_metrics(Metrics* metrics){ this->metrics = metrics; }
+        
+        const Framebuffer& get_display() const { return display; }
+        unsigned long get_cycle_count() const { return cycle_count; }
+        int get_clock_hertz() const { return clock_hertz; }
+        unsigned int get_seed() const { return seed; }
+        const unsigned char* get_registers() const { return v; }
+        unsigned short get_I() const { return I; }
+        unsigned short get_pc() const { return pc; }
+        unsigned int get_delay_timer() const { return delay_timer; }
+        unsigned int get_sound_timer() const { return sound_timer; }
+        unsigned int get_stack_pointer() const { return stack_ptr; }
+        //stack[1] to stack[get_stack_pointer()] hold return addresses, the innermost last
+        const unsigned int* get_stack() const { return stack; }
+        const unsigned char* get_memory() const { return memory; }
+        
+        //which interpreter variant runs, chosen once here instead of checked per instruction. Profiles other than
+        //QUIRKS_CHIP8 bypass the JIT, which only knows the original behaviour
+        void set_quirks(QuirkProfile profile);
+        QuirkProfile get_quirks() const { return quirks; }
+        
+        //how fast a throttled frontend runs relative to clock_hertz: 1 is real time, 2 twice as fast, 0 as fast as possible
+        void set_speed(double speed){ this->speed = speed > 0 ? speed : 0; }
+        
+        //fast-forward: while engaged a throttled frontend runs at speed instead (0 as fast as possible) and only every
+        //frame_skip-th frame is presented; timers still tick once per emulated frame. Engaged for the whole run with
+        //always, otherwise while Frontend::fast_forward says so. frame_skip 0 shows about 60 frames per second
+        void set_turbo(double speed, unsigned int frame_skip, bool always);
+        
+        //measured over the last run
+        struct FrameStats{
+            unsigned long frames;
+            double seconds;
+            double effective_hertz; //instructions executed per wall clock second
+            double jitter_mean_us; //how late the frames woke up compared to their deadlines, only when paced
+            double jitter_max_us;
+            unsigned long idle_cycles; //instructions of idle loops that were fast-forwarded instead of interpreted
+            unsigned long turbo_frames; //frames run in fast-forward
+            unsigned long presented; //frames passed to update_display
+            unsigned long fused_pairs; //instruction pairs run through one fused handler, see fuse
+        };
+        const FrameStats& get_frame_stats() const { return frame_stats; }
+        
+        //the whole machine, for save states. keep_keys leaves the held keys as they are instead of restoring the saved
+        //ones: frontends that only report key changes would otherwise leave keys stuck that changed since the save
+        void save_state(MachineState& state) const;
+        void load_state(const MachineState& state, bool keep_keys = false);
+        
+        //copy the machine into fork. Memory pages left alone since the last save_fork or load_fork are shared with that
+        //fork instead of copied, so forking a running machine costs little more than its registers and screen
+        void save_fork(Fork& fork);
+        //only bytes that differ from memory are written, so the decoded code of the rest stays valid
+        void load_fork(const Fork& fork);
+        
+        //continue from state (copied) on the next run, right after the ROM is loaded; null starts the ROM from scratch
+        void set_resume_state(const MachineState* state);
+        
+        //snapshot every frame into capacity_bytes of history that the frontend can rewind through, 0 turns it off
+        void enable_rewind(size_t capacity_bytes);
         
+        //seed for Cxkk, applied at the start of every run (0 uses default_seed)
+        void set_seed(unsigned int seed){ this->seed = seed != 0 ? seed : default_seed; }
+        
+        static const unsigned int default_seed = 0x2545F491;
+        static const int default_clock_hertz = 500;
+        
+        //loaded at address 0, five bytes per hexadecimal digit
+        static const unsigned char font_set[5 * 16];
+        
+        //the generator behind Cxkk, advances state and returns the next value
+        static unsigned int next_random(unsigned int& state);
+    
+    //decoding
+        //one handler per instruction, OP_DECODE marks a cache entry that has to be (re)decoded before it runs
+        enum Op : unsigned char{
+            OP_DECODE,
+            OP_CLS, OP_RET, OP_JP, OP_CALL,
+            OP_SE_VX_KK, OP_SNE_VX_KK, OP_SE_VX_VY, OP_LD_VX_KK, OP_ADD_VX_KK,
+            OP_LD_VX_VY, OP_OR, OP_AND, OP_XOR, OP_ADD_VX_VY,
+            OP_SUB, OP_SHR, OP_SUBN, OP_SHL, OP_SNE_VX_VY,
+            OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP,
+            OP_SKNP, OP_LD_VX_DT, OP_LD_VX_K, OP_LD_DT_VX, OP_LD_ST_VX,
+            OP_ADD_I_VX, OP_LD_F_VX, OP_LD_B_VX, OP_LD_I_VX, OP_LD_VX_I,
+            OP_INVALID,
+            //fused pairs, only ever produced by fuse: Annn+Fx65, Annn+Fx55, Annn+Fx1E, 6xkk+6ykk, 3xkk+1nnn, 4xkk+1nnn
+            OP_LD_I_LD_VX_I, OP_LD_I_LD_I_VX, OP_LD_I_ADD_I_VX, OP_LD_VX_KK_LD_VX_KK, OP_SE_VX_KK_JP, OP_SNE_VX_KK_JP,
+            //a breakpoint, only ever put in the cache by OP_DECODE
+            OP_BREAK,
+            OP_COUNT
+        };
+        
+        //an opcode with its operands already extracted (n is kk & 0xF)
+        struct Instruction{
+            unsigned char op;
+            unsigned char x;
+            unsigned char y;
+            unsigned char kk;
+            unsigned short nnn;
+        };
+        
+        static Instruction decode(unsigned short opcode);
+        //first and the instruction right after it as one fused instruction, or first unchanged if the pair does not fuse.
+        //Fused operands: Annn pairs keep nnn with x from the second, 6xkk pairs put the second x and kk in y and nnn,
+        //skip and jump pairs keep x and kk with nnn from the jump
+        static Instruction fuse(Instruction first, Instruction second);
+        static const char* describe(unsigned short opcode);
+        //the opcode pattern of an Op, like "8xy4"
+        static const char* mnemonic(unsigned char op);
+    
     private: 
     //cpu stuff
-        const int default_clock_hertz = 500;
         int clock_hertz;
-        const unsigned char font_set[5 * 16] = {
-            0xF0, 0x90, 0x90, 0x90, 0xF0, //0
-            0x20, 0x60, 0x20, 0x20, 0x70, //1
-            0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
-            0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
-            0x90, 0x90, 0xF0, 0x10, 0x10, //4
-            0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
-            0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
-            0xF0, 0x10, 0x20, 0x40, 0x40, //7
-            0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
-            0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
-            0xF0, 0x90, 0xF0, 0x90, 0x90, //A
-            0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
-            0xF0, 0x80, 0x80, 0x80, 0xF0, //C
-            0xE0, 0x90, 0x90, 0x90, 0xE0, //D
-            0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
-            0xF0, 0x80, 0xF0, 0x80, 0x80  //F
-        };
         
         unsigned char memory[4096];
         
@@ -53,34 +210,81 @@ namespace chip{
         
         void init_cpu();
         bool load_game(std::string fileName);
+        bool load_game(const unsigned char* rom, size_t size);
+        std::string run_loaded();
+        std::string run_machine();
         int execute_cycle();
+        int execute_cycles(unsigned long count);
+        //the interpreter, compiled for each quirk profile once with the profiling hooks and once without
+        template<typename Quirks, bool profiling> int interpret(unsigned long count);
+        template<typename Quirks> void use_quirks();
+        QuirkProfile quirks;
+        //the instantiations for the current profile, without and with profiling
+        typedef int (Chip::*Interpreter)(unsigned long count);
+        Interpreter interpreters[2];
         void update_timers();
         
-    // display stuff
-        const int pixel_size = 20;
-        SDL_Window* window;
-        SDL_Renderer* renderer;
+        //decoded instruction cache, indexed by address since jumps may land on odd addresses. An entry may hold a fused
+        //pair, which covers the four bytes from its address
+        Instruction decoded[4096];
         
-        bool display[64 * 32];
+        unsigned short fetch(unsigned short address) const;
+        void invalidate(unsigned short address);
+        void invalidate_all();
         
-        bool init_display();
-        void clear_display();
-        void update_display();
-        void clean_up_display();
+        //the pages memory was last saved to or loaded from as a fork, and a bit for each page written since
+        std::shared_ptr<Fork::Page> pages[Fork::page_count];
+        unsigned int dirty_pages;
         
-    //keyboard stuff
-        const SDL_Keycode keycodes[16] = {
-            SDLK_x, SDLK_1, SDLK_2, SDLK_3, SDLK_q, SDLK_w, SDLK_e, SDLK_a, SDLK_s, SDLK_d, SDLK_z, SDLK_c, SDLK_4, SDLK_r, SDLK_f, SDLK_v
-        };
+        std::bitset<4096> breakpoints;
+        std::bitset<4096> watchpoints;
+        unsigned int breakpoint_count;
+        unsigned int watchpoint_count;
+        int watch_hit;
         
-        bool keys[16];
-        void init_keyboard();
+        Jit* jit;
+        int execute_jit(unsigned long count);
+        
+        Tracer* tracer;
+        Profiler* profiler;
+        Metrics* metrics;
+        
+        MachineState* resume_state;
+        Rewind* rewind;
+        void trace(unsigned long cycle);
         
-        long elapsed_time = 0;
+        unsigned long cycle_count;
+        ExitReason exit_reason;
         
-        bool update_keys();
+        unsigned int seed;
+        unsigned int random_state;
         
-    //TODO: implement sound
+        double speed;
+        double turbo_speed;
+        unsigned int turbo_frame_skip;
+        bool turbo_always;
+        FrameStats frame_stats;
+        int run_frames();
+        //instructions in frame number frame, spread so that any clock_hertz averages out exactly over 60 frames
+        unsigned long frame_cycles(unsigned long frame) const {
+            return (frame + 1) * clock_hertz / 60 - frame * clock_hertz / 60;
+        }
+        //count instructions on the JIT when it can be used, the interpreter otherwise
+        int execute(unsigned long count);
+        //frames run through run_frame since load, and instructions left in the current one
+        unsigned long host_frames;
+        unsigned long frame_left;
+        bool sounding;
+    
+    // display stuff
+        Frontend& frontend;
+        Frontend* owned_frontend;
+        
+        Framebuffer display;
+    
+    //keyboard stuff
+        KeyMask keys;
+        void init_keyboard();
     };
 }
 
@@ -0,0 +1,85 @@
+#include "fork.hpp"
+
+namespace chip{
+    namespace{
+        const std::shared_ptr<Fork::Page>& zero_page(){
+            static const std::shared_ptr<Fork::Page> page = std::make_shared<Fork::Page>();
+            return page;
+        }
+    }
+    
+    Fork::Fork(){
+        memset(v, 0, sizeof(v));
+        memset(stack, 0, sizeof(stack));
+        I = 0;
+        pc = 0;
+        stack_ptr = 0;
+        delay_timer = 0;
+        sound_timer = 0;
+        keys = 0;
+        random_state = 0;
+        cycle_count = 0;
+        for(int i = 0; i < page_count; i++){
+            pages[i] = zero_page();
+        }
+    }
+    
+    Fork::Fork(const MachineState& state){
+        memcpy(v, state.v, sizeof(v));
+        memcpy(stack, state.stack, sizeof(stack));
+        I = state.I;
+        pc = state.pc;
+        stack_ptr = state.stack_ptr;
+        delay_timer = state.delay_timer;
+        sound_timer = state.sound_timer;
+        keys = 0;
+        for(int i = 0; i < 16; i++){
+            keys |= (state.keys[i] ? 1 : 0) << i;
+        }
+        random_state = state.random_state;
+        cycle_count = state.cycle_count;
+        display = state.display;
+        for(int i = 0; i < page_count; i++){
+            pages[i] = std::make_shared<Page>();
+            memcpy(pages[i]->bytes, &state.memory[i * page_size], page_size);
+        }
+    }
+    
+    void Fork::to_state(MachineState& state) const {
+        memcpy(state.v, v, sizeof(v));
+        memcpy(state.stack, stack, sizeof(stack));
+        state.I = I;
+        state.pc = pc;
+        state.stack_ptr = stack_ptr;
+        state.delay_timer = delay_timer;
+        state.sound_timer = sound_timer;
+        for(int i = 0; i < 16; i++){
+            state.keys[i] = (keys >> i) & 1;
+        }
+        state.random_state = random_state;
+        state.cycle_count = cycle_count;
+        state.display = display;
+        for(int i = 0; i < page_count; i++){
+            memcpy(&state.memory[i * page_size], pages[i]->bytes, page_size);
+        }
+    }
+    
+    void Fork::write(unsigned short address, uint8_t value){
+        std::shared_ptr<Page>& page = pages[(address & 0xFFF) / page_size];
+        //only this fork can add owners to a page it holds alone, so the count cannot go up behind our back
+        if(page.use_count() != 1){
+            page = std::make_shared<Page>(*page);
+        }
+        page->bytes[address % page_size] = value;
+    }
+    
+    size_t Fork::private_bytes() const {
+        size_t bytes = 0;
+        for(int i = 0; i < page_count; i++){
+            if(pages[i].use_count() == 1){
+                bytes += sizeof(Page);
+            }
+        }
+        return bytes;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef FORK_HPP
+#define FORK_HPP
+
+#include "state.hpp"
+#include<memory>
+#include<cstdint>
+
+namespace chip{
+    //a machine that is cheap to copy, for searches that branch many variations off one point. Registers and screen are
+    //copied, memory is split into pages that copies share until one of them writes there.
+    //Made by Chip::save_fork, continued by Chip::load_fork or Chip::run
+    class Fork{
+    
+    public:
+        static const int page_size = 256;
+        static const int page_count = 4096 / page_size;
+        struct Page{
+            uint8_t bytes[page_size];
+        };
+        
+        //registers and memory all zero, the pages are shared by every such fork
+        Fork();
+        explicit Fork(const MachineState& state);
+        void to_state(MachineState& state) const;
+        
+        uint8_t read(unsigned short address) const {
+            return pages[(address & 0xFFF) / page_size]->bytes[address % page_size];
+        }
+        //copies the page first if any other fork still uses it
+        void write(unsigned short address, uint8_t value);
+        
+        //whether both point at the same copy of page index
+        bool shares_page(const Fork& other, int index) const { return pages[index] == other.pages[index]; }
+        //memory no other fork (or machine) holds, what this one costs on top of sizeof(Fork)
+        size_t private_bytes() const;
+        
+        uint8_t v[16];
+        uint16_t I;
+        uint16_t pc;
+        uint16_t stack[16];
+        uint8_t stack_ptr;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        uint16_t keys; //bit i is key i
+        uint32_t random_state;
+        uint64_t cycle_count;
+        Framebuffer display;
+    
+    private:
+        friend class Chip;
+        
+        //never written once shared, write and Chip::save_fork make a new page instead
+        std::shared_ptr<Page> pages[page_count];
+    };
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include<cstddef>
+
+namespace chip{
+    //64-bit FNV-1a, used for framebuffer, register and ROM hashes
+    inline unsigned long long hash_bytes(const void* data, size_t size, unsigned long long hash = 14695981039346656037ULL){
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++){
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+}
+
+#endif
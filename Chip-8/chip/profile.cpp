@@ -0,0 +1,232 @@
+#include "profile.hpp"
+#include "chip.hpp"
+#include<algorithm>
+#include<iomanip>
+#include<sstream>
+#include<cstring>
+
+namespace chip{
+    const unsigned long Profiler::max_period;
+    const unsigned int Profiler::draw_sample_rate;
+    
+    namespace{
+        const char* const section_names[Profiler::SECTION_COUNT] = {"Dxyn", "update_display", "update_keys"};
+        
+        //indices of the non-zero entries of counts, largest first, at most top of them
+        std::vector<int> top_entries(const unsigned long long* counts, int size, int top){
+            std::vector<int> order;
+            for(int i = 0; i < size; i++){
+                if(counts[i] != 0){
+                    order.push_back(i);
+                }
+            }
+            std::stable_sort(order.begin(), order.end(), [counts](int a, int b){ return counts[a] > counts[b]; });
+            if(top > 0 && order.size() > (size_t)top){
+                order.resize(top);
+            }
+            return order;
+        }
+    }
+    
+    Profiler::Profiler(){
+        clear();
+        
+        //the average, not the minimum: on some virtual machines reading the clock varies by several times
+        const int samples = 4096;
+        uint64_t total = 0;
+        for(int i = 0; i < samples; i++){
+            const uint64_t start = now();
+            total += now() - start;
+        }
+        clock_overhead_ns = total / samples;
+    }
+    
+    void Profiler::clear(){
+        memset(pc_counts, 0, sizeof(pc_counts));
+        memset(pc_ops, 0, sizeof(pc_ops));
+        memset(op_counts, 0, sizeof(op_counts));
+        memset(fused_counts, 0, sizeof(fused_counts));
+        total = 0;
+        memset(branch_counts, 0, sizeof(branch_counts));
+        memset(branch_targets, 0, sizeof(branch_targets));
+        memset(section_ns, 0, sizeof(section_ns));
+        memset(section_calls, 0, sizeof(section_calls));
+        memset(section_timed, 0, sizeof(section_timed));
+        
+        nodes.assign(1, Node{-1, 0x200, 0, -1});
+        children.clear();
+        random = 0x9E3779B9;
+        restart(1);
+    }
+    
+    void Profiler::restart(unsigned long period){
+        this->period = std::max(1ul, std::min(period, max_period));
+        countdown = 0;
+        weight = 0;
+        pending = false;
+        last_depth = 0;
+        sample_node = 0;
+    }
+    
+    void Profiler::flush(){
+        if(pending && weight != 0){
+            pc_counts[sample_pc] += weight;
+            pc_ops[sample_pc] = sample_op;
+            op_counts[sample_op] += weight;
+            if(sample_pair != 0){
+                fused_counts[sample_pair] += weight;
+            }
+            nodes[sample_node].instructions += weight;
+        }
+        weight = 0;
+    }
+    
+    int Profiler::child(int parent, unsigned short address){
+        const int last = nodes[parent].last_child;
+        if(last != -1 && nodes[last].address == address){
+            return last;
+        }
+        
+        const std::pair<int, unsigned short> key(parent, address);
+        std::map<std::pair<int, unsigned short>, int>::iterator it = children.find(key);
+        if(it == children.end()){
+            nodes.push_back(Node{parent, address, 0, -1});
+            it = children.insert(std::make_pair(key, (int)nodes.size() - 1)).first;
+        }
+        nodes[parent].last_child = it->second;
+        return it->second;
+    }
+    
+    void Profiler::sample(unsigned short pc, unsigned char op, unsigned char pair, const unsigned int* stack, unsigned int depth, const unsigned char* memory){
+        flush();
+        pending = true;
+        sample_pc = pc & 0xFFF;
+        sample_op = op;
+        sample_pair = pair;
+        
+        depth = std::min(depth, 15u);
+        if(depth != last_depth || memcmp(last_stack + 1, stack + 1, depth * sizeof(*stack)) != 0){
+            //each open call is a 2nnn at its return address; one that was overwritten since is left out of the stack
+            int node = 0;
+            for(unsigned int i = 1; i <= depth; i++){
+                const unsigned short site = stack[i] & 0xFFF;
+                const unsigned short opcode = memory[site] << 8 | memory[(site + 1) & 0xFFF];
+                if((opcode & 0xF000) == 0x2000){
+                    node = child(node, opcode & 0xFFF);
+                }
+            }
+            sample_node = node;
+            memcpy(last_stack + 1, stack + 1, depth * sizeof(*stack));
+            last_depth = depth;
+        }
+        
+        if(period == 1){
+            countdown = 1;
+        }
+        else{
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            countdown = period / 2 + random % period;
+        }
+    }
+    
+    std::string Profiler::stack_of(int node) const {
+        std::string stack;
+        for(int i = node; i != -1; i = nodes[i].parent){
+            std::stringstream frame;
+            frame << std::hex << nodes[i].address;
+            stack = stack.empty() ? frame.str() : frame.str() + ";" + stack;
+        }
+        return stack;
+    }
+    
+    void Profiler::report(std::ostream& out, int top) const {
+        const double percent = total != 0 ? 100.0 / total : 0;
+        const std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(2);
+        
+        out << "Instructions: " << total << "\n";
+        if(period > 1){
+            out << "Addresses, opcode classes, fused pairs and subroutines are estimated from a sample every " << period
+                << " instructions on average\n";
+        }
+        
+        out << "\nHost time:\n";
+        for(int i = 0; i < SECTION_COUNT; i++){
+            //sampled sections are scaled up from the calls that were timed
+            const double per_call = section_timed[i] != 0 ? (double)section_ns[i] / section_timed[i] : 0;
+            out << "  " << std::left << std::setw(16) << section_names[i] << std::right
+                << std::setw(12) << section_calls[i] << " calls "
+                << std::setw(12) << per_call * section_calls[i] / 1e6 << " ms "
+                << std::setw(10) << per_call << " ns/call\n";
+        }
+        
+        out << "\nOpcode classes:\n";
+        std::vector<int> ops = top_entries(op_counts, 256, 0);
+        for(size_t i = 0; i < ops.size(); i++){
+            out << "  " << std::left << std::setw(8) << Chip::mnemonic(ops[i]) << std::right
+                << std::setw(14) << op_counts[ops[i]] << std::setw(8) << op_counts[ops[i]] * percent << "%\n";
+        }
+        
+        //each pair is counted where it starts and stands for two of the instructions counted above, a taken skip runs only the first
+        std::vector<int> pairs = top_entries(fused_counts, 256, 0);
+        unsigned long long fused_total = 0;
+        for(size_t i = 0; i < pairs.size(); i++){
+            fused_total += 2 * fused_counts[pairs[i]];
+        }
+        out << "\nFused pairs: " << fused_total * percent << "% of instructions\n";
+        for(size_t i = 0; i < pairs.size(); i++){
+            out << "  " << std::left << std::setw(10) << Chip::mnemonic(pairs[i]) << std::right
+                << std::setw(12) << fused_counts[pairs[i]] << std::setw(8) << 2 * fused_counts[pairs[i]] * percent << "%\n";
+        }
+        
+        out << "\nHot addresses:\n";
+        std::vector<int> pcs = top_entries(pc_counts, 4096, top);
+        for(size_t i = 0; i < pcs.size(); i++){
+            out << "  " << std::hex << std::setw(3) << std::setfill('0') << pcs[i] << std::dec << std::setfill(' ')
+                << "  " << std::left << std::setw(8) << Chip::mnemonic(pc_ops[pcs[i]]) << std::right
+                << std::setw(14) << pc_counts[pcs[i]] << std::setw(8) << pc_counts[pcs[i]] * percent << "%\n";
+        }
+        
+        out << "\nHot loops (backward branches):\n";
+        std::vector<int> loops = top_entries(branch_counts, 4096, top);
+        for(size_t i = 0; i < loops.size(); i++){
+            out << "  " << std::hex << std::setfill('0') << std::setw(3) << branch_targets[loops[i]] << "-"
+                << std::setw(3) << loops[i] << std::dec << std::setfill(' ')
+                << std::setw(14) << branch_counts[loops[i]] << " iterations\n";
+        }
+        
+        out << "\nSubroutines (including callees):\n";
+        std::map<unsigned short, unsigned long long> inclusive;
+        for(size_t i = 0; i < nodes.size(); i++){
+            //charge every ancestor once, recursion would otherwise count the same instructions twice
+            std::vector<unsigned short> seen;
+            for(int j = i; j != -1; j = nodes[j].parent){
+                if(std::find(seen.begin(), seen.end(), nodes[j].address) == seen.end()){
+                    seen.push_back(nodes[j].address);
+                    inclusive[nodes[j].address] += nodes[i].instructions;
+                }
+            }
+        }
+        std::vector<std::pair<unsigned long long, unsigned short> > subroutines;
+        for(std::map<unsigned short, unsigned long long>::const_iterator it = inclusive.begin(); it != inclusive.end(); ++it){
+            subroutines.push_back(std::make_pair(it->second, it->first));
+        }
+        std::stable_sort(subroutines.begin(), subroutines.end(), [](const std::pair<unsigned long long, unsigned short>& a, const std::pair<unsigned long long, unsigned short>& b){ return a.first > b.first; });
+        for(size_t i = 0; i < subroutines.size() && (top <= 0 || i < (size_t)top); i++){
+            out << "  " << std::hex << std::setw(3) << std::setfill('0') << subroutines[i].second << std::dec << std::setfill(' ')
+                << std::setw(24) << subroutines[i].first << std::setw(8) << subroutines[i].first * percent << "%\n";
+        }
+        
+        out.flags(flags);
+    }
+    
+    void Profiler::write_folded(std::ostream& out) const {
+        for(size_t i = 0; i < nodes.size(); i++){
+            if(nodes[i].instructions != 0){
+                out << stack_of(i) << " " << nodes[i].instructions << "\n";
+            }
+        }
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include<vector>
+#include<map>
+#include<string>
+#include<ostream>
+#include<chrono>
+#include<cstdint>
+
+namespace chip{
+    //where a ROM spends its time: executions per address and per opcode class, backward branches (loops), the call
+    //tree of 2nnn/00EE subroutines, and the host time spent drawing and talking to the frontend.
+    //Addresses, opcode classes, fused pairs and the call tree are sampled: Chip::execute_cycles runs profiled bursts in
+    //stretches of a random length around the sample period and takes a sample (the pc, its instruction and the machine's
+    //own return stack) at the start of each, weighted by how many instructions the stretch ran. The interpreter itself
+    //only counts backward branches. With a period of 1 every instruction is a sample and the counts are exact
+    class Profiler{
+    
+    public:
+        //host time is measured for these
+        enum Section{
+            SECTION_DRAW, //Dxyn
+            SECTION_DISPLAY, //Frontend::update_display
+            SECTION_KEYS, //Frontend::update_keys
+            SECTION_COUNT
+        };
+        
+        Profiler();
+        
+        void clear();
+        
+        //starts a new run at the top of the call tree, with period instructions between samples on average
+        //(1 to max_period)
+        void restart(unsigned long period);
+        static const unsigned long max_period = 256;
+        //charges the sample in progress with what it ran so far
+        void flush();
+        
+        //called by Chip::execute_cycles: a sample is taken whenever one is due, then at most until_sample instructions run
+        bool sample_due() const { return countdown == 0; }
+        unsigned long until_sample() const { return countdown; }
+        //op is the instruction at pc, pair the fused Op the cache holds there or 0; stack[1] to stack[depth] are the
+        //addresses of the 2nnn calls that are still open, memory is read to find where they went
+        void sample(unsigned short pc, unsigned char op, unsigned char pair, const unsigned int* stack, unsigned int depth, const unsigned char* memory);
+        void ran(unsigned long instructions){
+            total += instructions;
+            weight += instructions;
+            countdown -= instructions;
+        }
+        
+        //called by the interpreter on every jump to the same or a lower address
+        void backward_branch(unsigned short from, unsigned short to){
+            branch_counts[from & 0xFFF]++;
+            branch_targets[from & 0xFFF] = to;
+        }
+        
+        static uint64_t now(){
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        //adds the time since start (from now()) to section
+        void add_time(Section section, uint64_t start){
+            section_ns[section] += elapsed(start);
+            section_calls[section]++;
+            section_timed[section]++;
+        }
+        //Dxyn is too short to read the clock around every time, only one in draw_sample_rate is timed and the total
+        //is extrapolated from those
+        static const unsigned int draw_sample_rate = 256;
+        bool sample_draw(){
+            return (section_calls[SECTION_DRAW]++ & (draw_sample_rate - 1)) == 0;
+        }
+        void add_draw_time(uint64_t start){
+            section_ns[SECTION_DRAW] += elapsed(start);
+            section_timed[SECTION_DRAW]++;
+        }
+        
+        //exact, not sampled
+        unsigned long long get_instructions() const { return total; }
+        
+        //human readable summary, top lists limited to top entries each
+        void report(std::ostream& out, int top = 20) const;
+        //one line per call stack, "200;2a4;31c 1234", for flamegraph.pl and compatible viewers
+        void write_folded(std::ostream& out) const;
+    
+    private:
+        //estimated executions per address, opcode class and fused pair (counted once per pair)
+        unsigned long long pc_counts[4096];
+        unsigned char pc_ops[4096]; //the instruction last sampled at each address
+        unsigned long long op_counts[256];
+        unsigned long long fused_counts[256];
+        unsigned long long total;
+        
+        //indexed by the address of the jump
+        unsigned long long branch_counts[4096];
+        unsigned short branch_targets[4096];
+        
+        //call tree, node 0 is the code that is not in any subroutine
+        struct Node{
+            int parent;
+            unsigned short address;
+            unsigned long long instructions;
+            //the child entered last, loops usually call the same subroutine over and over
+            int last_child;
+        };
+        std::vector<Node> nodes;
+        std::map<std::pair<int, unsigned short>, int> children;
+        int child(int parent, unsigned short address);
+        
+        //the sample in progress, charged with weight instructions once the next one is taken
+        unsigned long period;
+        unsigned long countdown;
+        unsigned long weight;
+        bool pending;
+        unsigned short sample_pc;
+        unsigned char sample_op;
+        unsigned char sample_pair;
+        int sample_node;
+        //the return stack the last node was found for, stacks rarely change between samples
+        unsigned int last_stack[16];
+        unsigned int last_depth;
+        //xorshift state for the stretch lengths, so they cannot fall into step with a loop
+        uint32_t random;
+        
+        uint64_t section_ns[SECTION_COUNT];
+        unsigned long long section_calls[SECTION_COUNT];
+        unsigned long long section_timed[SECTION_COUNT];
+        //what reading the clock twice costs by itself, taken off every timed call
+        uint64_t clock_overhead_ns;
+        
+        uint64_t elapsed(uint64_t start) const {
+            const uint64_t ns = now() - start;
+            return ns > clock_overhead_ns ? ns - clock_overhead_ns : 0;
+        }
+        
+        std::string stack_of(int node) const;
+    };
+}
+
+#endif
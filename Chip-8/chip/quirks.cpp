@@ -0,0 +1,62 @@
+#include "quirks.hpp"
+#include<sstream>
+#include<cstdlib>
+
+namespace chip{
+    namespace{
+        const char* const names[QUIRKS_COUNT] = {"chip8", "vip", "schip", "xochip"};
+    }
+    
+    const char* quirks_name(QuirkProfile profile){
+        return profile < QUIRKS_COUNT ? names[profile] : "?";
+    }
+    
+    bool parse_quirks(const std::string& name, QuirkProfile& profile){
+        for(int i = 0; i < QUIRKS_COUNT; i++){
+            if(name == names[i]){
+                profile = (QuirkProfile)i;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool QuirksDatabase::load(std::istream& in, std::string& error){
+        std::string line;
+        for(int number = 1; std::getline(in, line); number++){
+            const size_t comment = line.find('#');
+            if(comment != std::string::npos){
+                line.erase(comment);
+            }
+            
+            std::istringstream fields(line);
+            std::string hash;
+            std::string name;
+            if(!(fields >> hash)){
+                continue;
+            }
+            
+            char* end;
+            const unsigned long long rom_hash = strtoull(hash.c_str(), &end, 16);
+            QuirkProfile profile;
+            std::string extra;
+            if(*end != '\0' || !(fields >> name) || !parse_quirks(name, profile) || fields >> extra){
+                std::stringstream message;
+                message << "line " << number << ": expected a ROM hash and one of chip8, vip, schip or xochip";
+                error = message.str();
+                return false;
+            }
+            add(rom_hash, profile);
+        }
+        return true;
+    }
+    
+    bool QuirksDatabase::lookup(unsigned long long rom_hash, QuirkProfile& profile) const {
+        std::map<unsigned long long, QuirkProfile>::const_iterator it = profiles.find(rom_hash);
+        if(it == profiles.end()){
+            return false;
+        }
+        profile = it->second;
+        return true;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef QUIRKS_HPP
+#define QUIRKS_HPP
+
+#include<string>
+#include<map>
+#include<istream>
+
+namespace chip{
+    //behaviours that differ between CHIP-8 implementations. Each profile is a policy type that the interpreter is
+    //instantiated with, so the quirks are settled at compile time and cost nothing per instruction:
+    //  shift_vy      8xy6/8xyE shift Vy into Vx instead of shifting Vx in place
+    //  load_store_i  Fx55/Fx65 leave I pointing past the last register instead of unchanged
+    //  clip_sprites  Dxyn cuts sprites off at the right and bottom edges instead of wrapping them around
+    //  jump_vx       Bnnn is BxNN, a jump to xNN plus Vx instead of nnn plus V0
+    struct QuirksChip8{ //what this interpreter has always done, as in Cowgod's technical reference
+        static const bool shift_vy = false;
+        static const bool load_store_i = false;
+        static const bool clip_sprites = false;
+        static const bool jump_vx = false;
+    };
+    struct QuirksVip{ //the original COSMAC VIP interpreter
+        static const bool shift_vy = true;
+        static const bool load_store_i = true;
+        static const bool clip_sprites = true;
+        static const bool jump_vx = false;
+    };
+    struct QuirksSchip{ //SUPER-CHIP 1.1
+        static const bool shift_vy = false;
+        static const bool load_store_i = false;
+        static const bool clip_sprites = true;
+        static const bool jump_vx = true;
+    };
+    struct QuirksXochip{ //XO-CHIP
+        static const bool shift_vy = true;
+        static const bool load_store_i = true;
+        static const bool clip_sprites = false;
+        static const bool jump_vx = false;
+    };
+    
+    //the policy types above, for choosing one at run time
+    enum QuirkProfile{
+        QUIRKS_CHIP8,
+        QUIRKS_VIP,
+        QUIRKS_SCHIP,
+        QUIRKS_XOCHIP,
+        QUIRKS_COUNT
+    };
+    
+    //"chip8", "vip", "schip" or "xochip"
+    const char* quirks_name(QuirkProfile profile);
+    //false if name is none of those
+    bool parse_quirks(const std::string& name, QuirkProfile& profile);
+    
+    //the profile each known ROM needs, by the hash_bytes of the ROM file
+    class QuirksDatabase{
+    
+    public:
+        //lines of "<hexadecimal ROM hash> <profile name>", blank lines and anything after a # are skipped.
+        //Stops at the first line that does not parse and describes it in error
+        bool load(std::istream& in, std::string& error);
+        
+        void add(unsigned long long rom_hash, QuirkProfile profile){ profiles[rom_hash] = profile; }
+        //false, leaving profile alone, if the ROM is not listed
+        bool lookup(unsigned long long rom_hash, QuirkProfile& profile) const;
+        
+        size_t size() const { return profiles.size(); }
+    
+    private:
+        std::map<unsigned long long, QuirkProfile> profiles;
+    };
+}
+
+#endif
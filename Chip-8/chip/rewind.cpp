@@ -0,0 +1,154 @@
+#include "rewind.hpp"
+
+namespace chip{
+    namespace{
+        void write_count(unsigned char*& out, size_t count){
+            while(count >= 0x80){
+                *out++ = (count & 0x7F) | 0x80;
+                count >>= 7;
+            }
+            *out++ = count;
+        }
+        
+        size_t read_count(const unsigned char*& in){
+            size_t count = 0;
+            int shift = 0;
+            while(*in & 0x80){
+                count |= (size_t)(*in++ & 0x7F) << shift;
+                shift += 7;
+            }
+            count |= (size_t)*in++ << shift;
+            return count;
+        }
+        
+        uint64_t load_word(const unsigned char* p){
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            return word;
+        }
+    }
+    
+    Rewind::Rewind(size_t capacity_bytes) : buffer(capacity_bytes), scratch(2 * sizeof(MachineState) + 16){
+        clear();
+    }
+    
+    void Rewind::clear(){
+        deltas.clear();
+        write_offset = 0;
+        has_newest = false;
+    }
+    
+    size_t Rewind::bytes_used() const {
+        size_t used = 0;
+        for(size_t i = 0; i < deltas.size(); i++){
+            used += deltas[i].size;
+        }
+        return used;
+    }
+    
+    void Rewind::push(const MachineState& state){
+        if(has_newest){
+            const size_t size = encode(newest, state);
+            unsigned char* dest = reserve(size);
+            if(dest != nullptr){
+                memcpy(dest, scratch.data(), size);
+                deltas.push_back({static_cast<size_t>(dest - buffer.data()), size});
+            }
+        }
+        newest = state;
+        has_newest = true;
+    }
+    
+    bool Rewind::step_back(MachineState& state){
+        if(deltas.empty()){
+            return false;
+        }
+        
+        //XOR is its own inverse, so the delta that led to the newest state also leads back from it
+        const Delta delta = deltas.back();
+        deltas.pop_back();
+        decode(&buffer[delta.offset], delta.size, newest);
+        write_offset = delta.offset;
+        
+        state = newest;
+        return true;
+    }
+    
+    //alternating runs of unchanged bytes (just a count) and changed bytes (a count and the XOR of each),
+    //the trailing unchanged run is left out. Unchanged stretches are skipped a word at a time
+    size_t Rewind::encode(const MachineState& older, const MachineState& newer){
+        const unsigned char* a = reinterpret_cast<const unsigned char*>(&older);
+        const unsigned char* b = reinterpret_cast<const unsigned char*>(&newer);
+        const size_t n = sizeof(MachineState);
+        unsigned char* out = scratch.data();
+        
+        size_t i = 0;
+        while(i < n){
+            const size_t same_start = i;
+            while(i + 8 <= n && load_word(a + i) == load_word(b + i)){
+                i += 8;
+            }
+            while(i < n && a[i] == b[i]){
+                i++;
+            }
+            if(i == n){
+                break;
+            }
+            
+            //a changed run ends at the first three unchanged bytes in a row, shorter gaps are cheaper to copy
+            const size_t changed_start = i;
+            while(i < n && !(a[i] == b[i] && (i + 1 >= n || a[i + 1] == b[i + 1]) && (i + 2 >= n || a[i + 2] == b[i + 2]))){
+                i++;
+            }
+            
+            write_count(out, changed_start - same_start);
+            write_count(out, i - changed_start);
+            for(size_t j = changed_start; j < i; j++){
+                *out++ = a[j] ^ b[j];
+            }
+        }
+        return out - scratch.data();
+    }
+    
+    void Rewind::decode(const unsigned char* data, size_t size, MachineState& state){
+        unsigned char* bytes = reinterpret_cast<unsigned char*>(&state);
+        const unsigned char* in = data;
+        const unsigned char* end = data + size;
+        
+        size_t position = 0;
+        while(in < end){
+            position += read_count(in);
+            const size_t changed = read_count(in);
+            for(size_t j = 0; j < changed; j++){
+                bytes[position++] ^= *in++;
+            }
+        }
+    }
+    
+    //room for size contiguous bytes, dropping the oldest deltas in the way; null if it can never fit
+    unsigned char* Rewind::reserve(size_t size){
+        if(size > buffer.size()){
+            deltas.clear();
+            write_offset = 0;
+            return nullptr;
+        }
+        if(deltas.empty()){
+            write_offset = 0;
+        }
+        
+        if(write_offset + size > buffer.size()){
+            //everything still stored past this point is older than what sits at the start of the buffer
+            while(!deltas.empty() && deltas.front().offset >= write_offset){
+                deltas.pop_front();
+            }
+            write_offset = 0;
+        }
+        while(!deltas.empty() && deltas.front().offset >= write_offset && deltas.front().offset < write_offset + size){
+            deltas.pop_front();
+        }
+        
+        unsigned char* dest = &buffer[write_offset];
+        write_offset += size;
+        return dest;
+    }
+}
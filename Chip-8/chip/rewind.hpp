@@ -0,0 +1,51 @@
+#ifndef REWIND_HPP
+#define REWIND_HPP
+
+#include "state.hpp"
+#include<vector>
+#include<deque>
+
+namespace chip{
+    //history of machine states in a fixed amount of memory. Only the newest state is kept whole, every older one is
+    //stored as the run-length encoded XOR against the state after it, so unchanged memory and screen cost almost nothing.
+    //When the buffer is full the oldest deltas are dropped.
+    class Rewind{
+    
+    public:
+        Rewind(size_t capacity_bytes);
+        
+        void push(const MachineState& state);
+        
+        //replaces state with the one pushed before the newest and forgets the newest, false when there is no older one
+        bool step_back(MachineState& state);
+        
+        void clear();
+        
+        //how many states step_back can still go back to
+        size_t size() const { return deltas.size(); }
+        size_t bytes_used() const;
+    
+    private:
+        struct Delta{
+            size_t offset;
+            size_t size;
+        };
+        
+        //compressed deltas live in a circular byte buffer, oldest first in the deque
+        std::vector<unsigned char> buffer;
+        std::deque<Delta> deltas;
+        size_t write_offset;
+        
+        MachineState newest;
+        bool has_newest;
+        
+        //scratch space for one encoded delta, the worst case is slightly larger than a state
+        std::vector<unsigned char> scratch;
+        
+        size_t encode(const MachineState& older, const MachineState& newer);
+        static void decode(const unsigned char* data, size_t size, MachineState& state);
+        unsigned char* reserve(size_t size);
+    };
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef STATE_HPP
+#define STATE_HPP
+
+#include "framebuffer.hpp"
+#include<vector>
+#include<cstring>
+#include<cstdint>
+
+namespace chip{
+    //everything a running machine needs to carry on exactly where it was, as one flat block of bytes so that
+    //snapshots can be copied, compared and XORed with memcpy-like loops
+    struct MachineState{
+        uint8_t memory[4096];
+        uint8_t v[16];
+        uint16_t I;
+        uint16_t pc;
+        uint16_t stack[16];
+        uint8_t stack_ptr;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        uint8_t keys[16];
+        uint32_t random_state;
+        uint64_t cycle_count;
+        Framebuffer display;
+        
+        //zeroes padding too, so equal machines always have equal bytes
+        MachineState(){
+            memset(static_cast<void*>(this), 0, sizeof(*this));
+        }
+        
+        //a save file: a short header followed by the raw struct, readable on hosts with the same byte order
+        std::vector<unsigned char> serialize() const {
+            std::vector<unsigned char> out(sizeof(magic) + sizeof(MachineState));
+            memcpy(out.data(), magic, sizeof(magic));
+            memcpy(out.data() + sizeof(magic), this, sizeof(MachineState));
+            return out;
+        }
+        
+        //false (leaving the state untouched) if data is not a save file of this version
+        bool deserialize(const unsigned char* data, size_t size){
+            if(size != sizeof(magic) + sizeof(MachineState) || memcmp(data, magic, sizeof(magic)) != 0){
+                return false;
+            }
+            memcpy(static_cast<void*>(this), data + sizeof(magic), sizeof(MachineState));
+            return true;
+        }
+        
+        static constexpr char magic[8] = {'C', 'H', '8', 'S', 'T', 'A', 'T', '1'};
+    };
+}
+
+#endif
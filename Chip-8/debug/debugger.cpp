@@ -0,0 +1,427 @@
+#include "debugger.hpp"
+#include<sstream>
+#include<iomanip>
+#include<vector>
+#include<cstdlib>
+#include<cctype>
+
+namespace chip{
+    namespace{
+        //hexadecimal, with or without 0x, and nothing after it
+        bool parse_number(const std::string& text, unsigned long& value){
+            if(text.empty()){
+                return false;
+            }
+            char* end;
+            value = strtoul(text.c_str(), &end, 16);
+            return *end == '\0';
+        }
+        
+        //v0-vf are 0-15, then i, dt and st; -1 for anything else
+        int parse_register(std::string name){
+            for(size_t i = 0; i < name.size(); i++){
+                name[i] = tolower(name[i]);
+            }
+            if(name.size() == 2 && name[0] == 'v' && isxdigit(name[1])){
+                return strtoul(name.c_str() + 1, nullptr, 16);
+            }
+            const char* const others[3] = {"i", "dt", "st"};
+            for(int i = 0; i < 3; i++){
+                if(name == others[i]){
+                    return 16 + i;
+                }
+            }
+            return -1;
+        }
+        
+        std::string hex(unsigned int value, int digits){
+            std::ostringstream out;
+            out << std::hex << std::uppercase << std::setfill('0') << std::setw(digits) << value;
+            return out.str();
+        }
+        
+        const char* const help_text =
+            "break ADDR [if REG OP VALUE]  stop before ADDR, optionally only while e.g. \"v3 == 5\" (REG v0-vf, i, dt, st)\n"
+            "delete ADDR                   remove a breakpoint\n"
+            "watch ADDR [LEN]              stop after Fx33/Fx55 write to ADDR..ADDR+LEN-1\n"
+            "unwatch ADDR [LEN]            remove watchpoints\n"
+            "info                          list breakpoints and watchpoints\n"
+            "step [N], next, continue [FRAMES]\n"
+            "regs, mem ADDR [LEN], list [ADDR] [N], screen, keys MASK, quit\n"
+            "Numbers are hexadecimal, an empty line repeats the last command.\n";
+    }
+    
+    Debugger::Debugger(Chip& chip) : chip(chip), interrupted(false){
+        return_address = -1;
+        return_depth = 0;
+    }
+    
+    Debugger::~Debugger(){
+        //the machine outlives the debugger, and should not keep stopping for it
+        for(auto it = breakpoints.begin(); it != breakpoints.end(); ++it){
+            chip.set_breakpoint(it->first, false);
+        }
+        for(auto it = watchpoints.begin(); it != watchpoints.end(); ++it){
+            chip.set_watchpoint(*it, false);
+        }
+    }
+    
+    void Debugger::repl(std::istream& in, std::ostream& out){
+        print_listing(chip.get_pc(), 1, out);
+        std::string line;
+        while(out << "(chip8) " << std::flush, std::getline(in, line)){
+            if(!command(line, out)){
+                return;
+            }
+        }
+        out << std::endl;
+    }
+    
+    bool Debugger::command(std::string line, std::ostream& out){
+        if(line.find_first_not_of(" \t") == std::string::npos){
+            line = last_command;
+        }
+        last_command = line;
+        
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        std::vector<std::string> args;
+        std::string arg;
+        while(fields >> arg){
+            args.push_back(arg);
+        }
+        
+        unsigned long address = 0;
+        unsigned long count = 0;
+        if(name.empty()){
+            return true;
+        }
+        else if(name == "quit" || name == "q"){
+            return false;
+        }
+        else if(name == "help" || name == "h"){
+            out << help_text;
+        }
+        else if(name == "break" || name == "b"){
+            Condition condition = {true, 0, "", 0};
+            if(args.empty() || !parse_number(args[0], address) || address > 0xFFF){
+                out << "Usage: break ADDR [if REG OP VALUE]" << std::endl;
+                return true;
+            }
+            if(args.size() > 1){
+                unsigned long value;
+                const char* const comparisons[6] = {"==", "!=", "<", "<=", ">", ">="};
+                bool known = false;
+                for(int i = 0; args.size() == 5 && i < 6; i++){
+                    known = known || args[3] == comparisons[i];
+                }
+                if(args.size() != 5 || args[1] != "if" || (condition.reg = parse_register(args[2])) < 0 || !known || !parse_number(args[4], value)){
+                    out << "Conditions look like: if v3 == 5" << std::endl;
+                    return true;
+                }
+                condition.always = false;
+                condition.comparison = args[3];
+                condition.value = value;
+            }
+            breakpoints[address] = condition;
+            chip.set_breakpoint(address, true);
+            out << "Breakpoint at " << hex(address, 3) << std::endl;
+        }
+        else if(name == "delete" || name == "d"){
+            if(args.size() != 1 || !parse_number(args[0], address) || breakpoints.erase(address) == 0){
+                out << "No such breakpoint." << std::endl;
+                return true;
+            }
+            chip.set_breakpoint(address, false);
+        }
+        else if(name == "watch" || name == "w" || name == "unwatch"){
+            count = 1;
+            if(args.empty() || !parse_number(args[0], address) || (args.size() > 1 && !parse_number(args[1], count)) || address + count > 0x1000){
+                out << "Usage: " << name << " ADDR [LEN]" << std::endl;
+                return true;
+            }
+            for(unsigned long i = 0; i < count; i++){
+                const unsigned short watched = address + i;
+                if(name == "unwatch"){
+                    chip.set_watchpoint(watched, false);
+                    watchpoints.erase(watched);
+                }
+                //one already set by other code stays theirs
+                else if(!chip.has_watchpoint(watched)){
+                    chip.set_watchpoint(watched, true);
+                    watchpoints.insert(watched);
+                }
+            }
+        }
+        else if(name == "info" || name == "i"){
+            for(auto it = breakpoints.begin(); it != breakpoints.end(); ++it){
+                out << "break " << hex(it->first, 3);
+                if(!it->second.always){
+                    const int reg = it->second.reg;
+                    out << " if " << (reg < 16 ? "v" + hex(reg, 1) : reg == 16 ? "i" : reg == 17 ? "dt" : "st")
+                        << " " << it->second.comparison << " " << hex(it->second.value, 1);
+                }
+                out << std::endl;
+            }
+            //consecutive watched addresses as ranges
+            for(int start = 0; start < 4096; start++){
+                if(chip.has_watchpoint(start)){
+                    int end = start;
+                    while(end + 1 < 4096 && chip.has_watchpoint(end + 1)){
+                        end++;
+                    }
+                    out << "watch " << hex(start, 3) << " " << hex(end - start + 1, 1) << std::endl;
+                    start = end;
+                }
+            }
+        }
+        else if(name == "step" || name == "s"){
+            count = 1;
+            if(!args.empty() && (!parse_number(args[0], count) || count == 0)){
+                out << "Usage: step [N]" << std::endl;
+                return true;
+            }
+            report(resume(count, 0), out);
+        }
+        else if(name == "next" || name == "n"){
+            const unsigned short pc = chip.get_pc();
+            if(Chip::decode(fetch(pc)).op != Chip::OP_CALL){
+                report(resume(1, 0), out);
+                return true;
+            }
+            return_address = (pc + 2) & 0xFFF;
+            return_depth = chip.get_stack_pointer();
+            const bool user_breakpoint = chip.has_breakpoint(return_address);
+            chip.set_breakpoint(return_address, true);
+            const Stop stop = resume(0, 0);
+            if(!user_breakpoint){
+                chip.set_breakpoint(return_address, false);
+            }
+            return_address = -1;
+            report(stop, out);
+        }
+        else if(name == "continue" || name == "c"){
+            if(!args.empty() && !parse_number(args[0], count)){
+                out << "Usage: continue [FRAMES]" << std::endl;
+                return true;
+            }
+            report(resume(0, count), out);
+        }
+        else if(name == "regs" || name == "r"){
+            print_registers(out);
+        }
+        else if(name == "mem" || name == "x"){
+            count = 0x40;
+            if(args.empty() || !parse_number(args[0], address) || (args.size() > 1 && !parse_number(args[1], count))){
+                out << "Usage: mem ADDR [LEN]" << std::endl;
+                return true;
+            }
+            const unsigned char* memory = chip.get_memory();
+            for(unsigned long i = 0; i < count; i++){
+                if(i % 16 == 0){
+                    out << (i != 0 ? "\n" : "") << hex((address + i) & 0xFFF, 3) << ":";
+                }
+                out << " " << hex(memory[(address + i) & 0xFFF], 2);
+            }
+            out << std::endl;
+        }
+        else if(name == "list" || name == "l"){
+            address = chip.get_pc();
+            count = 10;
+            if((args.size() > 0 && !parse_number(args[0], address)) || (args.size() > 1 && !parse_number(args[1], count))){
+                out << "Usage: list [ADDR] [N]" << std::endl;
+                return true;
+            }
+            print_listing(address, count, out);
+            //a bare return keeps paging forward
+            last_command = "list " + hex((address + 2 * count) & 0xFFF, 3) + " " + hex(count, 1);
+        }
+        else if(name == "screen"){
+            const Framebuffer& display = chip.get_display();
+            for(int y = 0; y < Framebuffer::height; y++){
+                for(int x = 0; x < Framebuffer::width; x++){
+                    out << (display.pixel(x, y) ? '#' : '.');
+                }
+                out << '\n';
+            }
+            out << std::flush;
+        }
+        else if(name == "keys" || name == "k"){
+            if(args.size() != 1 || !parse_number(args[0], count) || count > 0xFFFF){
+                out << "Usage: keys MASK" << std::endl;
+                return true;
+            }
+            chip.set_keys(count);
+        }
+        else{
+            out << "Unknown command " << name << ", try help." << std::endl;
+        }
+        return true;
+    }
+    
+    Debugger::Stop Debugger::resume(unsigned long instructions, unsigned long frames){
+        interrupted.store(false, std::memory_order_relaxed);
+        const unsigned long start_cycles = chip.get_cycle_count();
+        const unsigned long start_frames = chip.get_frames();
+        Stop stop = STOP_DONE;
+        
+        if(chip.has_breakpoint(chip.get_pc()) && !step_over_breakpoint(stop)){
+            return stop;
+        }
+        
+        while(true){
+            const unsigned long ran = chip.get_cycle_count() - start_cycles;
+            if((instructions != 0 && ran >= instructions) || (frames != 0 && chip.get_frames() - start_frames >= frames)){
+                return STOP_DONE;
+            }
+            if(interrupted.exchange(false, std::memory_order_relaxed)){
+                return STOP_INTERRUPTED;
+            }
+            
+            //a whole frame at a time unless steps are counted, then the Chip stops by itself wherever it has to
+            const int pc = chip.run_frame(instructions != 0 ? instructions - ran : ~0ul);
+            if(chip.get_watch_hit() != -1){
+                return STOP_WATCHPOINT;
+            }
+            if(pc == -1){
+                continue;
+            }
+            if(!chip.has_breakpoint(pc)){
+                return STOP_INVALID_OPCODE;
+            }
+            if(pc == return_address && chip.get_stack_pointer() == return_depth){
+                return STOP_DONE;
+            }
+            auto it = breakpoints.find(pc);
+            if(it != breakpoints.end() && holds(it->second)){
+                return STOP_BREAKPOINT;
+            }
+            //its condition does not hold, or it is next's return address inside a deeper call
+            if(!step_over_breakpoint(stop)){
+                return stop;
+            }
+        }
+    }
+    
+    bool Debugger::step_over_breakpoint(Stop& stop){
+        const unsigned short pc = chip.get_pc();
+        const unsigned long before = chip.get_cycle_count();
+        chip.set_breakpoint(pc, false);
+        int error = -1;
+        //a frame may end first, that runs no instruction and only ticks the timers
+        while(error == -1 && chip.get_cycle_count() == before){
+            error = chip.run_frame(1);
+        }
+        chip.set_breakpoint(pc, true);
+        
+        if(error != -1){
+            stop = STOP_INVALID_OPCODE;
+            return false;
+        }
+        if(chip.get_watch_hit() != -1){
+            stop = STOP_WATCHPOINT;
+            return false;
+        }
+        return true;
+    }
+    
+    bool Debugger::holds(const Condition& condition) const {
+        if(condition.always){
+            return true;
+        }
+        const int reg = condition.reg;
+        const unsigned int value = reg < 16 ? chip.get_registers()[reg] : reg == 16 ? chip.get_I()
+            : reg == 17 ? chip.get_delay_timer() : chip.get_sound_timer();
+        const std::string& c = condition.comparison;
+        return c == "==" ? value == condition.value : c == "!=" ? value != condition.value
+            : c == "<" ? value < condition.value : c == "<=" ? value <= condition.value
+            : c == ">" ? value > condition.value : value >= condition.value;
+    }
+    
+    unsigned short Debugger::fetch(unsigned short address) const {
+        const unsigned char* memory = chip.get_memory();
+        return (memory[address & 0xFFF] << 8) | memory[(address + 1) & 0xFFF];
+    }
+    
+    void Debugger::report(Stop stop, std::ostream& out) const {
+        const unsigned short pc = chip.get_pc();
+        switch(stop){
+            case STOP_BREAKPOINT: out << "Breakpoint at " << hex(pc, 3) << std::endl; break;
+            case STOP_WATCHPOINT: out << "Watchpoint: " << hex(chip.get_watch_hit(), 3) << " written" << std::endl; break;
+            case STOP_INVALID_OPCODE: out << "Invalid opcode " << hex(fetch(pc), 4) << " at " << hex(pc, 3) << std::endl; break;
+            case STOP_INTERRUPTED: out << "Interrupted" << std::endl; break;
+            case STOP_DONE: break;
+        }
+        print_listing(pc, 1, out);
+    }
+    
+    void Debugger::print_registers(std::ostream& out) const {
+        const unsigned char* v = chip.get_registers();
+        for(int i = 0; i < 16; i++){
+            out << "V" << hex(i, 1) << "=" << hex(v[i], 2) << (i % 8 == 7 ? "\n" : " ");
+        }
+        out << "I=" << hex(chip.get_I(), 3) << " PC=" << hex(chip.get_pc(), 3) << " SP=" << chip.get_stack_pointer()
+            << " DT=" << hex(chip.get_delay_timer(), 2) << " ST=" << hex(chip.get_sound_timer(), 2)
+            << " cycle=" << chip.get_cycle_count() << " frame=" << chip.get_frames() << "\n";
+        out << "stack:";
+        for(unsigned int i = 1; i <= chip.get_stack_pointer() && i < 16; i++){
+            out << " " << hex(chip.get_stack()[i], 3);
+        }
+        out << std::endl;
+    }
+    
+    void Debugger::print_listing(unsigned short address, int count, std::ostream& out) const {
+        for(int i = 0; i < count; i++){
+            const unsigned short at = (address + 2 * i) & 0xFFF;
+            out << (at == chip.get_pc() ? "=>" : "  ") << (chip.has_breakpoint(at) && at != return_address ? "*" : " ")
+                << hex(at, 3) << "  " << hex(fetch(at), 4) << "  " << disassemble(fetch(at)) << '\n';
+        }
+        out << std::flush;
+    }
+    
+    std::string Debugger::disassemble(unsigned short opcode){
+        const Chip::Instruction ins = Chip::decode(opcode);
+        const std::string x = "V" + hex(ins.x, 1);
+        const std::string y = "V" + hex(ins.y, 1);
+        const std::string kk = "0x" + hex(ins.kk, 2);
+        const std::string nnn = "0x" + hex(ins.nnn, 3);
+        switch(ins.op){
+            case Chip::OP_CLS: return "CLS";
+            case Chip::OP_RET: return "RET";
+            case Chip::OP_JP: return "JP " + nnn;
+            case Chip::OP_CALL: return "CALL " + nnn;
+            case Chip::OP_SE_VX_KK: return "SE " + x + ", " + kk;
+            case Chip::OP_SNE_VX_KK: return "SNE " + x + ", " + kk;
+            case Chip::OP_SE_VX_VY: return "SE " + x + ", " + y;
+            case Chip::OP_LD_VX_KK: return "LD " + x + ", " + kk;
+            case Chip::OP_ADD_VX_KK: return "ADD " + x + ", " + kk;
+            case Chip::OP_LD_VX_VY: return "LD " + x + ", " + y;
+            case Chip::OP_OR: return "OR " + x + ", " + y;
+            case Chip::OP_AND: return "AND " + x + ", " + y;
+            case Chip::OP_XOR: return "XOR " + x + ", " + y;
+            case Chip::OP_ADD_VX_VY: return "ADD " + x + ", " + y;
+            case Chip::OP_SUB: return "SUB " + x + ", " + y;
+            case Chip::OP_SHR: return "SHR " + x + ", " + y;
+            case Chip::OP_SUBN: return "SUBN " + x + ", " + y;
+            case Chip::OP_SHL: return "SHL " + x + ", " + y;
+            case Chip::OP_SNE_VX_VY: return "SNE " + x + ", " + y;
+            case Chip::OP_LD_I: return "LD I, " + nnn;
+            case Chip::OP_JP_V0: return "JP V0, " + nnn;
+            case Chip::OP_RND: return "RND " + x + ", " + kk;
+            case Chip::OP_DRW: return "DRW " + x + ", " + y + ", " + hex(ins.kk & 0xF, 1);
+            case Chip::OP_SKP: return "SKP " + x;
+            case Chip::OP_SKNP: return "SKNP " + x;
+            case Chip::OP_LD_VX_DT: return "LD " + x + ", DT";
+            case Chip::OP_LD_VX_K: return "LD " + x + ", K";
+            case Chip::OP_LD_DT_VX: return "LD DT, " + x;
+            case Chip::OP_LD_ST_VX: return "LD ST, " + x;
+            case Chip::OP_ADD_I_VX: return "ADD I, " + x;
+            case Chip::OP_LD_F_VX: return "LD F, " + x;
+            case Chip::OP_LD_B_VX: return "LD B, " + x;
+            case Chip::OP_LD_I_VX: return "LD [I], " + x;
+            case Chip::OP_LD_VX_I: return "LD " + x + ", [I]";
+        }
+        return "DW 0x" + hex(opcode, 4);
+    }
+}
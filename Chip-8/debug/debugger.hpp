@@ -0,0 +1,91 @@
+#ifndef DEBUGGER_HPP
+#define DEBUGGER_HPP
+
+#include "chip.hpp"
+#include<atomic>
+#include<map>
+#include<set>
+#include<string>
+#include<istream>
+#include<ostream>
+
+namespace chip{
+    //an interactive debugger on text streams, so it works in a terminal without a window. It drives the machine through
+    //Chip::run_frame, so the timers tick as in a normal run, and leaves stopping to the breakpoints and watchpoints
+    //patched into the Chip: with none set a continue runs exactly as fast as a host calling run_frame itself.
+    //Commands (numbers are hexadecimal, an empty line repeats the last command):
+    //  break ADDR [if REG OP VALUE]  stop before ADDR runs, if given only while REG (v0-vf, i, dt, st) compares
+    //                                true (==, !=, <, <=, >, >=) against VALUE
+    //  delete ADDR                   remove the breakpoint at ADDR
+    //  watch ADDR [LEN]              stop after Fx33 or Fx55 writes anywhere in ADDR to ADDR+LEN-1
+    //  unwatch ADDR [LEN]            remove those watchpoints
+    //  info                          list breakpoints and watchpoints
+    //  step [N]                      run N instructions (default 1)
+    //  next                          like step, but run a 2nnn call through to its return
+    //  continue [FRAMES]             run until something stops the machine, or FRAMES frames have passed
+    //  regs                          registers, timers and the stack
+    //  mem ADDR [LEN]                hex dump of memory
+    //  list [ADDR] [N]               disassemble N instructions (default 10) from ADDR (default pc)
+    //  screen                        the display as text
+    //  keys MASK                     hold the keys in MASK, bit i is key i
+    //  help, quit
+    class Debugger{
+    
+    public:
+        explicit Debugger(Chip& chip);
+        ~Debugger();
+        
+        //reads and runs commands until quit or the end of in
+        void repl(std::istream& in, std::ostream& out);
+        //runs one command line, false once it was quit
+        bool command(std::string line, std::ostream& out);
+        
+        //why resume returned
+        enum Stop{
+            STOP_DONE, //ran as many instructions or frames as asked
+            STOP_BREAKPOINT,
+            STOP_WATCHPOINT,
+            STOP_INVALID_OPCODE,
+            STOP_INTERRUPTED
+        };
+        //runs up to instructions instructions and frames frames (0 for no limit on either) until something stops the
+        //machine. The instruction at a breakpoint the machine stands on is run first, so resuming moves on
+        Stop resume(unsigned long instructions, unsigned long frames);
+        
+        //makes a resume end at the next frame boundary; only touches an atomic flag, so a signal handler may call it
+        void interrupt(){ interrupted.store(true, std::memory_order_relaxed); }
+        
+        //one instruction in the usual assembler syntax, like "LD V3, 0x12" or "DRW V0, V1, 5"
+        static std::string disassemble(unsigned short opcode);
+    
+    private:
+        //a breakpoint stops only while its condition holds; reg is 0-15 for V0-VF, then I, DT and ST
+        struct Condition{
+            bool always;
+            int reg;
+            std::string comparison;
+            unsigned int value;
+        };
+        bool holds(const Condition& condition) const;
+        
+        Chip& chip;
+        std::map<unsigned short, Condition> breakpoints;
+        //the watchpoints this debugger turned on, the only ones it turns off when it goes away
+        std::set<unsigned short> watchpoints;
+        std::atomic<bool> interrupted;
+        std::string last_command;
+        
+        //next puts a temporary breakpoint on the return address, and stops there only back at the caller's depth
+        int return_address;
+        unsigned int return_depth;
+        
+        unsigned short fetch(unsigned short address) const;
+        //runs the instruction at pc even if a breakpoint is on it, false if it stopped the machine anyway
+        bool step_over_breakpoint(Stop& stop);
+        void report(Stop stop, std::ostream& out) const;
+        void print_registers(std::ostream& out) const;
+        void print_listing(unsigned short address, int count, std::ostream& out) const;
+    };
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FRAMEBUFFER_HPP
+#define FRAMEBUFFER_HPP
+
+#include<cstdint>
+#include<cstring>
+
+namespace chip{
+    //the 64x32 screen, one 64-bit word per row with the leftmost pixel in the most significant bit
+    struct Framebuffer{
+        static const int width = 64;
+        static const int height = 32;
+        
+        uint64_t rows[height];
+        
+        void clear(){
+            memset(rows, 0, sizeof(rows));
+        }
+        
+        bool pixel(int x, int y) const {
+            return (rows[y] >> (width - 1 - x)) & 1;
+        }
+        
+        //XORs the n byte sprite at address in the 4 KB memory onto the screen at (x, y), wrapping around both edges,
+        //returns true if any pixel was erased
+        bool draw(unsigned char x, unsigned char y, const unsigned char* memory, unsigned short address, int n){
+            const int shift = x % width;
+            uint64_t collision = 0;
+            for(int i = 0; i < n; i++){
+                const uint64_t line = (uint64_t)memory[(address + i) & 0xFFF] << (width - 8);
+                const uint64_t rotated = shift == 0 ? line : (line >> shift) | (line << (width - shift));
+                
+                uint64_t& row = rows[(y + i) % height];
+                collision |= row & rotated;
+                row ^= rotated;
+            }
+            return collision != 0;
+        }
+        
+        //like draw, except that only the position wraps: what would go past the right or bottom edge is cut off
+        bool draw_clipped(unsigned char x, unsigned char y, const unsigned char* memory, unsigned short address, int n){
+            const int shift = x % width;
+            const int top = y % height;
+            uint64_t collision = 0;
+            for(int i = 0; i < n && top + i < height; i++){
+                const uint64_t line = ((uint64_t)memory[(address + i) & 0xFFF] << (width - 8)) >> shift;
+                
+                uint64_t& row = rows[top + i];
+                collision |= row & line;
+                row ^= line;
+            }
+            return collision != 0;
+        }
+        
+        //one bool per pixel, row by row, for renderers that want the unpacked layout
+        void unpack(bool out[width * height]) const {
+            for(int y = 0; y < height; y++){
+                for(int x = 0; x < width; x++){
+                    out[x + width * y] = pixel(x, y);
+                }
+            }
+        }
+        
+        bool operator==(const Framebuffer& other) const {
+            return memcmp(rows, other.rows, sizeof(rows)) == 0;
+        }
+        bool operator!=(const Framebuffer& other) const {
+            return !(*this == other);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FRONTEND_HPP
+#define FRONTEND_HPP
+
+#include "framebuffer.hpp"
+#include<string>
+#include<atomic>
+#include<cstdint>
+
+namespace chip{
+    //the held keys, bit i is key i. Atomic so that a frontend may also change it from a thread of its own
+    typedef std::atomic<uint16_t> KeyMask;
+    
+    //everything the interpreter needs from the outside world: somewhere to draw, and somewhere to read keys from
+    class Frontend{
+    
+    public:
+        virtual ~Frontend(){}
+        
+        virtual bool init() = 0;
+        virtual void clean_up() = 0;
+        
+        //called at the start of every 60 Hz frame, cycle is the number of instructions executed so far, returns false once the frontend wants the interpreter to stop
+        virtual bool update_keys(KeyMask& keys, unsigned long cycle) = 0;
+        
+        //called once per 60 Hz frame with the current screen, not on every draw
+        virtual void update_display(const Framebuffer& display) = 0;
+        
+        //called once per 60 Hz frame just before the timers tick, on is true while the sound timer is running
+        virtual void update_sound(bool /*on*/){}
+        
+        //true while the player holds the rewind control, each frame then steps back one snapshot instead of running
+        virtual bool rewinding() const { return false; }
+        
+        //true while the player holds the fast-forward control, see Chip::set_turbo
+        virtual bool fast_forward() const { return false; }
+        
+        //true if the interpreter should run at clock_hertz in real time, false to run as fast as possible
+        virtual bool throttled() const = 0;
+        
+        //how many finished frames so far were replaced by a newer one before they could be shown, for Metrics
+        virtual uint64_t dropped_frames() const { return 0; }
+        
+        //maximum number of cycles to execute, 0 means no limit
+        virtual unsigned long cycle_limit() const { return 0; }
+        
+        //returned by Chip::run when update_keys asked to stop
+        virtual std::string quit_message() const = 0;
+    };
+}
+
+#endif
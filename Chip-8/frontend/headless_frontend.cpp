@@ -0,0 +1,67 @@
+#include "headless_frontend.hpp"
+
+namespace chip{
+    HeadlessFrontend::HeadlessFrontend(unsigned long max_frames, unsigned long max_cycles){
+        this->max_frames = max_frames;
+        this->max_cycles = max_cycles;
+        frames = 0;
+        input = nullptr;
+        next_input = 0;
+        sound = nullptr;
+        sounding = false;
+    }
+    
+    void HeadlessFrontend::set_limits(unsigned long max_frames, unsigned long max_cycles){
+        this->max_frames = max_frames;
+        this->max_cycles = max_cycles;
+    }
+    
+    bool HeadlessFrontend::init(){
+        frames = 0;
+        next_input = 0;
+        sounding = false;
+        return true;
+    }
+    
+    void HeadlessFrontend::clean_up(){
+    }
+    
+    //called once per emulated frame on the unthrottled path
+    bool HeadlessFrontend::update_keys(KeyMask& keys, unsigned long cycle){
+        if(max_frames != 0 && frames >= max_frames){
+            return false;
+        }
+        frames++;
+        
+        //keys only change between frames, so an event applies from the first frame boundary at or after its cycle
+        if(input != nullptr){
+            while(next_input < input->size() && (*input)[next_input].cycle <= cycle){
+                keys.store((*input)[next_input].keys, std::memory_order_relaxed);
+                next_input++;
+            }
+        }
+        return true;
+    }
+    
+    void HeadlessFrontend::update_display(const Framebuffer& /*display*/){
+    }
+    
+    void HeadlessFrontend::update_sound(bool on){
+        if(on != sounding){
+            sounding = on;
+            if(sound != nullptr){
+                //frames was already counted in update_keys
+                sound->push_back({frames - 1, on});
+            }
+        }
+    }
+    
+    void HeadlessFrontend::dump_display(std::ostream& out, const Framebuffer& display){
+        for(int i = 0; i < Framebuffer::height; i++){
+            for(int j = 0; j < Framebuffer::width; j++){
+                out << (display.pixel(j, i) ? '#' : '.');
+            }
+            out << '\n';
+        }
+    }
+}
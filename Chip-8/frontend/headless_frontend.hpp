@@ -0,0 +1,61 @@
+#ifndef HEADLESS_FRONTEND_HPP
+#define HEADLESS_FRONTEND_HPP
+
+#include "frontend.hpp"
+#include<ostream>
+#include<vector>
+
+namespace chip{
+    //from cycle on, the keys whose bits are set in keys (bit i is key i) are held down
+    struct InputEvent{
+        unsigned long cycle;
+        unsigned short keys;
+    };
+    
+    //from frame on (counting from 0) the beeper is on or off
+    struct SoundEvent{
+        unsigned long frame;
+        bool on;
+    };
+    
+    //no window and no event pump, runs unthrottled until the frame or cycle limit is hit (0 means no limit)
+    class HeadlessFrontend : public Frontend{
+    
+    public:
+        HeadlessFrontend(unsigned long max_frames, unsigned long max_cycles);
+        
+        //events must be sorted by cycle and outlive the run, null for no input
+        void set_input(const std::vector<InputEvent>* input){ this->input = input; }
+        void set_limits(unsigned long max_frames, unsigned long max_cycles);
+        
+        //appends every change of the beeper to sound (null to stop), which starts out off
+        void set_sound_log(std::vector<SoundEvent>* sound){ this->sound = sound; }
+        
+        bool init() override;
+        void clean_up() override;
+        
+        bool update_keys(KeyMask& keys, unsigned long cycle) override;
+        void update_display(const Framebuffer& display) override;
+        void update_sound(bool on) override;
+        
+        bool throttled() const override { return false; }
+        unsigned long cycle_limit() const override { return max_cycles; }
+        std::string quit_message() const override { return "Frame limit reached."; }
+        
+        //writes the framebuffer as 32 lines of 64 characters, '#' for a lit pixel and '.' otherwise
+        static void dump_display(std::ostream& out, const Framebuffer& display);
+    
+    private:
+        unsigned long max_frames;
+        unsigned long max_cycles;
+        unsigned long frames;
+        
+        const std::vector<InputEvent>* input;
+        size_t next_input;
+        
+        std::vector<SoundEvent>* sound;
+        bool sounding;
+    };
+}
+
+#endif
@@ -0,0 +1,298 @@
+#include "sdl_frontend.hpp"
+#include<algorithm>
+#include<cstring>
+#include<cstdio>
+
+namespace chip{
+    SdlFrontend::SdlFrontend() : duplicated(0), beeping(false), held(0), quit_requested(false), rewind_held(false),
+        turbo_held(false){
+        window = nullptr;
+        audio_device = 0;
+        sample_rate = 0;
+        phase = 0;
+        gain = 0;
+        renderer = nullptr;
+        texture = nullptr;
+        overlay = false;
+        
+        for(int i = 0; i < 128; i++){
+            key_lookup[i] = -1;
+        }
+        for(int i = 0; i < 16; i++){
+            key_lookup[keycodes[i]] = i;
+        }
+    }
+    
+    std::string SdlFrontend::run(std::function<std::string()> emulate){
+        const bool opened = open();
+        std::atomic<bool> finished(false);
+        std::string message;
+        std::thread emulation([&emulate, &finished, &message](){
+            message = emulate();
+            finished.store(true, std::memory_order_release);
+        });
+        if(opened){
+            present(finished);
+        }
+        emulation.join();
+        close();
+        return message;
+    }
+    
+    bool SdlFrontend::open(){
+        SDL_Init(SDL_INIT_EVERYTHING);
+        window = SDL_CreateWindow("Chip8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 64 * pixel_size, 32 * pixel_size, SDL_WINDOW_SHOWN);
+        renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC) : nullptr;
+        texture = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, Framebuffer::width, Framebuffer::height) : nullptr;
+        if(!texture){
+            close();
+            return false;
+        }
+        
+        SDL_AudioSpec wanted;
+        memset(&wanted, 0, sizeof(wanted));
+        wanted.freq = 48000;
+        wanted.format = AUDIO_S16SYS;
+        wanted.channels = 1;
+        wanted.samples = audio_buffer_samples;
+        wanted.callback = &SdlFrontend::fill_audio;
+        wanted.userdata = this;
+        SDL_AudioSpec obtained;
+        beeping = false;
+        phase = 0;
+        gain = 0;
+        sample_rate = wanted.freq;
+        audio_device = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained, 0);
+        if(audio_device != 0){
+            SDL_PauseAudioDevice(audio_device, 0);
+        }
+        
+        return true;
+    }
+    
+    void SdlFrontend::close(){
+        if(audio_device != 0){
+            SDL_CloseAudioDevice(audio_device);
+            audio_device = 0;
+        }
+        if(texture){
+            SDL_DestroyTexture(texture);
+            texture = nullptr;
+        }
+        if(renderer){
+            SDL_DestroyRenderer(renderer);
+            renderer = nullptr;
+        }
+        if(window){
+            SDL_DestroyWindow(window);
+            window = nullptr;
+        }
+        SDL_Quit();
+    }
+    
+    void SdlFrontend::fill_audio(void* userdata, Uint8* stream, int length){
+        SdlFrontend* frontend = static_cast<SdlFrontend*>(userdata);
+        Sint16* samples = reinterpret_cast<Sint16*>(stream);
+        const int count = length / sizeof(Sint16);
+        
+        const double target = frontend->beeping.load(std::memory_order_relaxed) ? 1 : 0;
+        const double ramp = 1.0 / (0.002 * frontend->sample_rate);
+        const double step = (double)frontend->tone_hertz / frontend->sample_rate;
+        const double amplitude = 3000;
+        
+        for(int i = 0; i < count; i++){
+            if(frontend->gain < target){
+                frontend->gain = std::min(target, frontend->gain + ramp);
+            }
+            else if(frontend->gain > target){
+                frontend->gain = std::max(target, frontend->gain - ramp);
+            }
+            samples[i] = (Sint16)((frontend->phase < 0.5 ? amplitude : -amplitude) * frontend->gain);
+            
+            frontend->phase += step;
+            if(frontend->phase >= 1){
+                frontend->phase -= 1;
+            }
+        }
+    }
+    
+    void SdlFrontend::present(const std::atomic<bool>& finished){
+        //with vsync SDL_RenderPresent waits for the next refresh, without it the loop has to pace itself
+        SDL_RendererInfo info;
+        const bool vsync = SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC);
+        
+        Framebuffer shown;
+        bool shown_valid = false;
+        MetricsSample sample;
+        bool sample_valid = false;
+        while(!finished.load(std::memory_order_acquire)){
+            handle_events();
+            
+            //a new sample alone is reason enough to redraw, but only a missing game frame counts as a duplicate
+            const bool new_sample = overlay && samples.consume();
+            if(new_sample){
+                sample = samples.front();
+                sample_valid = true;
+            }
+            
+            if(frames.consume()){
+                //frames where nothing was drawn skip the upload
+                if(!shown_valid || frames.front() != shown){
+                    shown = frames.front();
+                    shown_valid = true;
+                    upload(shown);
+                }
+            }
+            else if(vsync){
+                if(shown_valid){
+                    duplicated.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            else if(!new_sample){
+                SDL_Delay(1);
+                continue;
+            }
+            
+            SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            if(sample_valid){
+                draw_overlay(sample);
+            }
+            SDL_RenderPresent(renderer);
+        }
+    }
+    
+    void SdlFrontend::handle_events(){
+        SDL_Event e;
+        while(SDL_PollEvent(&e)){
+            if (e.type == SDL_QUIT){
+                quit_requested.store(true, std::memory_order_relaxed);
+            }
+            else if(e.type == SDL_KEYDOWN){
+                if(e.key.keysym.sym == SDLK_BACKSPACE){
+                    rewind_held.store(true, std::memory_order_relaxed);
+                }
+                else if(e.key.keysym.sym == SDLK_TAB){
+                    turbo_held.store(true, std::memory_order_relaxed);
+                }
+                const int key = chip_key(e.key.keysym.sym);
+                if(key != -1){
+                    held.fetch_or(1 << key, std::memory_order_relaxed);
+                }
+            }
+            else if(e.type == SDL_KEYUP){
+                if(e.key.keysym.sym == SDLK_BACKSPACE){
+                    rewind_held.store(false, std::memory_order_relaxed);
+                }
+                else if(e.key.keysym.sym == SDLK_TAB){
+                    turbo_held.store(false, std::memory_order_relaxed);
+                }
+                const int key = chip_key(e.key.keysym.sym);
+                if(key != -1){
+                    held.fetch_and(~(1 << key), std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+    
+    bool SdlFrontend::update_keys(KeyMask& keys, unsigned long /*cycle*/){
+        //the whole mask rather than what changed, so keys are right again one frame after a rewind or a loaded state
+        keys.store(held.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return !quit_requested.load(std::memory_order_relaxed);
+    }
+    
+    void SdlFrontend::update_display(const Framebuffer& display){
+        frames.publish(display);
+    }
+    
+    void SdlFrontend::upload(const Framebuffer& display){
+        void* pixels;
+        int pitch;
+        if(SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0){
+            return;
+        }
+        for(int i = 0; i < Framebuffer::height; i++){
+            Uint32* line = reinterpret_cast<Uint32*>(static_cast<unsigned char*>(pixels) + i * pitch);
+            const uint64_t row = display.rows[i];
+            for(int j = 0; j < Framebuffer::width; j++){
+                line[j] = (row >> (Framebuffer::width - 1 - j)) & 1 ? 0xFFFFFFFF : 0xFF000000;
+            }
+        }
+        SDL_UnlockTexture(texture);
+    }
+    
+    //a 3x5 font for what the overlay prints, each row 3 bits with the leftmost pixel highest
+    static const unsigned char* glyph(char c){
+        static const unsigned char digits[10][5] = {
+            {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, {5, 5, 7, 1, 1},
+            {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}
+        };
+        static const struct{ char c; unsigned char rows[5]; } letters[] = {
+            {'D', {6, 5, 5, 5, 6}}, {'F', {7, 4, 6, 4, 4}}, {'I', {7, 2, 2, 2, 7}}, {'O', {7, 5, 5, 5, 7}},
+            {'P', {7, 5, 7, 4, 4}}, {'R', {6, 5, 6, 5, 5}}, {'S', {7, 4, 7, 1, 7}}
+        };
+        if(c >= '0' && c <= '9'){
+            return digits[c - '0'];
+        }
+        for(const auto& letter : letters){
+            if(letter.c == c){
+                return letter.rows;
+            }
+        }
+        return nullptr;
+    }
+    
+    void SdlFrontend::draw_text(const char* text, int x, int y){
+        const int dot = 3;
+        for(; *text != 0; text++, x += 4 * dot){
+            const unsigned char* rows = glyph(*text);
+            if(rows == nullptr){
+                continue;
+            }
+            for(int i = 0; i < 5; i++){
+                for(int j = 0; j < 3; j++){
+                    if((rows[i] >> (2 - j)) & 1){
+                        const SDL_Rect rect = {x + j * dot, y + i * dot, dot, dot};
+                        SDL_RenderFillRect(renderer, &rect);
+                    }
+                }
+            }
+        }
+    }
+    
+    //a translucent box with frames and instructions per second, the frames dropped in the last interval, and a bar
+    //splitting the interval between interpreting (red), the display (green), the keys (blue) and sleeping (grey)
+    void SdlFrontend::draw_overlay(const MetricsSample& sample){
+        const int x = 8;
+        const int y = 8;
+        const int bar_width = 180;
+        
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+        const SDL_Rect box = {x, y, bar_width + 16, 84};
+        SDL_RenderFillRect(renderer, &box);
+        
+        char line[32];
+        SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+        snprintf(line, sizeof(line), "FPS %.0f", sample.frames_per_second);
+        draw_text(line, x + 8, y + 8);
+        snprintf(line, sizeof(line), "IPS %.0f", sample.instructions_per_second);
+        draw_text(line, x + 8, y + 28);
+        snprintf(line, sizeof(line), "DROP %llu", (unsigned long long)sample.dropped);
+        draw_text(line, x + 8, y + 48);
+        
+        const double shares[4] = {sample.interpret, sample.display, sample.keys, sample.sleep};
+        const Uint8 colors[4][3] = {{220, 60, 60}, {60, 200, 60}, {80, 120, 255}, {128, 128, 128}};
+        int left = x + 8;
+        for(int i = 0; i < 4; i++){
+            const int width = std::min(x + 8 + bar_width - left, (int)(shares[i] * bar_width + 0.5));
+            if(width <= 0){
+                continue;
+            }
+            SDL_SetRenderDrawColor(renderer, colors[i][0], colors[i][1], colors[i][2], 255);
+            const SDL_Rect segment = {left, y + 68, width, 8};
+            SDL_RenderFillRect(renderer, &segment);
+            left += width;
+        }
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    }
+}
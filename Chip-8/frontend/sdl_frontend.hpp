@@ -0,0 +1,109 @@
+#ifndef SDL_FRONTEND_HPP
+#define SDL_FRONTEND_HPP
+
+#include "frontend.hpp"
+#include "triple_buffer.hpp"
+#include "metrics.hpp"
+#include<SDL2/SDL.h>
+#include<functional>
+#include<thread>
+
+namespace chip{
+    //SDL wants the window, its events and its renderer on the thread that created the window, and on macOS that has
+    //to be the main thread. So run keeps all of them on the thread that calls it and moves the interpreter to a thread
+    //of its own, which only hands frames over and picks the keys up: a slow SDL_RenderPresent (vsync, compositor
+    //stalls) never holds up emulation
+    class SdlFrontend : public Frontend{
+    
+    public:
+        SdlFrontend();
+        
+        //opens the window on this thread, then runs emulate (a Chip::run on this frontend) on another one while
+        //handling events and presenting frames here, until it returns. Without a window emulate still runs and is
+        //told so by init
+        std::string run(std::function<std::string()> emulate);
+        
+        //the window belongs to run, the interpreter only checks that there is one
+        bool init() override { return window != nullptr; }
+        void clean_up() override {}
+        
+        bool update_keys(KeyMask& keys, unsigned long cycle) override;
+        void update_display(const Framebuffer& display) override;
+        void update_sound(bool on) override { beeping.store(on, std::memory_order_relaxed); }
+        
+        bool rewinding() const override { return rewind_held.load(std::memory_order_relaxed); }
+        bool fast_forward() const override { return turbo_held.load(std::memory_order_relaxed); }
+        uint64_t dropped_frames() const override { return frames.get_dropped(); }
+        bool throttled() const override { return true; }
+        std::string quit_message() const override { return "Window terminated by user."; }
+        
+        //frames the interpreter finished, how many of them were replaced by a newer one before they could be shown,
+        //and how many refreshes showed the previous frame again because no new one was ready (only counted with vsync)
+        uint64_t get_published_frames() const { return frames.get_published(); }
+        uint64_t get_dropped_frames() const { return frames.get_dropped(); }
+        uint64_t get_duplicated_frames() const { return duplicated.load(std::memory_order_relaxed); }
+        
+        //draw the latest metrics sample over the game in the top left corner; call before run
+        void set_overlay(bool on){ overlay = on; }
+        //any thread, typically a MetricsPublisher listener; the window thread picks the newest one up
+        void show_metrics(const MetricsSample& sample){ samples.publish(sample); }
+    
+    private:
+    // display stuff
+        const int pixel_size = 20;
+        SDL_Window* window;
+        
+        //from the interpreter to the window thread, every frame
+        TripleBuffer<Framebuffer> frames;
+        std::atomic<uint64_t> duplicated;
+        
+        //the window, the renderer with a 64x32 streaming texture it scales up to the window, and the audio device;
+        //false leaves none of them open
+        bool open();
+        void close();
+        //handles events and presents frames until finished is set
+        void present(const std::atomic<bool>& finished);
+        
+        SDL_Renderer* renderer;
+        SDL_Texture* texture;
+        void upload(const Framebuffer& display);
+        
+        //from the metrics publisher to the window thread, which redraws as soon as one arrives
+        bool overlay;
+        TripleBuffer<MetricsSample> samples;
+        void draw_overlay(const MetricsSample& sample);
+        void draw_text(const char* text, int x, int y);
+    
+    //sound stuff
+        //a square wave produced by SDL's audio thread while beeping is set, in buffers of a few milliseconds.
+        //Neither side ever waits for the other; no device just means no sound
+        const int tone_hertz = 440;
+        const int audio_buffer_samples = 256;
+        SDL_AudioDeviceID audio_device;
+        std::atomic<bool> beeping;
+        
+        //only touched by the audio thread
+        int sample_rate;
+        double phase; //position in the current period, 0 to 1
+        double gain; //ramps towards 1 or 0 over a couple of milliseconds, so starting and stopping does not click
+        static void fill_audio(void* frontend, Uint8* stream, int length);
+    
+    //keyboard stuff
+        //kept by the window thread from its events, the interpreter copies the whole mask every frame
+        std::atomic<uint16_t> held;
+        std::atomic<bool> quit_requested;
+        void handle_events();
+        
+        //backspace rewinds and tab fast-forwards while held
+        std::atomic<bool> rewind_held;
+        std::atomic<bool> turbo_held;
+        const SDL_Keycode keycodes[16] = {
+            SDLK_x, SDLK_1, SDLK_2, SDLK_3, SDLK_q, SDLK_w, SDLK_e, SDLK_a, SDLK_s, SDLK_d, SDLK_z, SDLK_c, SDLK_4, SDLK_r, SDLK_f, SDLK_v
+        };
+        //the Chip8 key of each keycode (all of them are ASCII), -1 for keys that are not mapped
+        signed char key_lookup[128];
+        int chip_key(SDL_Keycode code) const { return code >= 0 && code < 128 ? key_lookup[code] : -1; }
+    };
+}
+
+#endif
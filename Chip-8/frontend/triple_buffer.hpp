@@ -0,0 +1,57 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include<atomic>
+#include<cstdint>
+
+namespace chip{
+    //hands values from one producer thread to one consumer thread without either ever waiting for the other.
+    //The producer writes into its own slot and swaps it with the shared middle slot, the consumer swaps the middle
+    //slot with its own when it holds something new. A value the consumer never picked up is simply replaced
+    template<typename T> class TripleBuffer{
+    
+    public:
+        TripleBuffer() : middle(1), back(0), front_index(2), published(0), dropped(0){}
+        
+        //producer: copy value in and make it the newest
+        void publish(const T& value){
+            slots[back] = value;
+            const unsigned int previous = middle.exchange(back | fresh, std::memory_order_acq_rel);
+            back = previous & index_mask;
+            if(previous & fresh){
+                dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            published.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        //consumer: true if something was published since the last call, front() is then the newest value
+        bool consume(){
+            if(!(middle.load(std::memory_order_relaxed) & fresh)){
+                return false;
+            }
+            front_index = middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+            return true;
+        }
+        const T& front() const { return slots[front_index]; }
+        
+        //values published so far, and how many of those were replaced before the consumer saw them
+        uint64_t get_published() const { return published.load(std::memory_order_relaxed); }
+        uint64_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+    
+    private:
+        static const unsigned int index_mask = 3;
+        static const unsigned int fresh = 4;
+        
+        T slots[3];
+        //index of the shared slot, with fresh set while it holds a value the consumer has not taken yet
+        std::atomic<unsigned int> middle;
+        //owned by the producer and the consumer respectively
+        alignas(64) unsigned int back;
+        alignas(64) unsigned int front_index;
+        
+        alignas(64) std::atomic<uint64_t> published;
+        std::atomic<uint64_t> dropped;
+    };
+}
+
+#endif
@@ -0,0 +1,364 @@
+#include "jit.hpp"
+#include<algorithm>
+#include<cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#include<sys/mman.h>
+#include<unistd.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+//Generated code follows the System V calling convention:
+//  rdi = v, rsi = memory, rdx = &I, rcx = &pc, r8 = &delay_timer, r9 = &sound_timer
+//The prologue moves &I to r10 and &pc to r11 so that eax, ecx and edx are free as scratch registers.
+//Every instruction is translated with the same order of reads and writes as the interpreter, so
+//overlapping registers (x == y, x == 0xF, ...) behave identically.
+
+namespace chip{
+    Jit::Jit(){
+        code_buffer = nullptr;
+        code_used = 0;
+        
+#if JIT_SUPPORTED
+        //mapped writable, then executable for good: hosts that refuse to switch (W^X policies) get no JIT
+        void* buffer = mmap(nullptr, code_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(buffer != MAP_FAILED){
+            code_buffer = static_cast<unsigned char*>(buffer);
+            protect(0, code_capacity, false);
+        }
+#endif
+        
+        flush();
+    }
+    
+    Jit::~Jit(){
+        release();
+    }
+    
+    bool Jit::protect(size_t start, size_t size, bool writable){
+#if JIT_SUPPORTED
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t first = start / page * page;
+        const size_t end = std::min(code_capacity, (start + size + page - 1) / page * page);
+        if(mprotect(code_buffer + first, end - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0){
+            return true;
+        }
+        release();
+#endif
+        return false;
+    }
+    
+    void Jit::release(){
+#if JIT_SUPPORTED
+        if(code_buffer != nullptr){
+            munmap(code_buffer, code_capacity);
+            code_buffer = nullptr;
+        }
+#endif
+    }
+    
+    void Jit::flush(){
+        for(int i = 0; i < 4096; i++){
+            blocks[i].code = nullptr;
+            blocks[i].length = 0;
+            blocks[i].read_bytes = 0;
+            blocks[i].translated = false;
+            covered[i] = false;
+        }
+        code_used = 0;
+    }
+    
+    //drops every block that was read from address; their code stays in the buffer until the next flush
+    void Jit::invalidate_blocks(unsigned short address){
+        const unsigned int max_read_bytes = 2 * max_block_length + 2;
+        for(unsigned int i = 0; i < max_read_bytes; i++){
+            Entry& entry = blocks[(address - i) & 0xFFF];
+            if(entry.translated && entry.read_bytes > i){
+                entry.code = nullptr;
+                entry.length = 0;
+                entry.read_bytes = 0;
+                entry.translated = false;
+            }
+        }
+    }
+    
+    Jit::Block Jit::lookup(unsigned short address, const unsigned char memory[4096], unsigned int& length){
+        Entry& entry = blocks[address & 0xFFF];
+        if(!entry.translated){
+            entry = translate(address & 0xFFF, memory);
+        }
+        length = entry.length;
+        return entry.code;
+    }
+    
+    Jit::Entry Jit::translate(unsigned short address, const unsigned char memory[4096]){
+        Entry entry;
+        entry.code = nullptr;
+        entry.length = 0;
+        entry.read_bytes = 0;
+        entry.translated = true;
+        
+        if(!available()){
+            return entry;
+        }
+        
+        out.clear();
+        emit({0x49, 0x89, 0xD2}); //mov r10, rdx
+        emit({0x49, 0x89, 0xCB}); //mov r11, rcx
+        
+        unsigned int length = 0;
+        bool terminated = false;
+        while(length < max_block_length){
+            const unsigned short at = (address + 2 * length) & 0xFFF;
+            const unsigned short opcode = (memory[at] << 8) | memory[(at + 1) & 0xFFF];
+            
+            if(emit_terminator(opcode, length)){
+                length++;
+                terminated = true;
+                break;
+            }
+            if(!emit_instruction(opcode)){
+                break;
+            }
+            length++;
+        }
+        
+        //the instruction that stopped translation was read too, so a write to it must flush this block
+        const unsigned int read_bytes = 2 * length + (terminated ? 0 : 2);
+        
+        if(length > 0){
+            if(!terminated){
+                emit_pc_add(2 * length);
+            }
+            emit({0xC3}); //ret
+            
+            if(code_used + out.size() > code_capacity){
+                flush();
+            }
+            
+            //only the pages being written are opened up, and closed again before anything can run from them.
+            //If that fails the buffer is gone, and every block with it: from here on everything is interpreted
+            if(!protect(code_used, out.size(), true)){
+                flush();
+                return entry;
+            }
+            memcpy(code_buffer + code_used, out.data(), out.size());
+            if(!protect(code_used, out.size(), false)){
+                flush();
+                return entry;
+            }
+            entry.code = reinterpret_cast<Block>(code_buffer + code_used);
+            entry.length = length;
+            code_used += out.size();
+        }
+        
+        entry.read_bytes = read_bytes;
+        for(unsigned int i = 0; i < read_bytes; i++){
+            covered[(address + i) & 0xFFF] = true;
+        }
+        
+        return entry;
+    }
+    
+    //straight-line instructions that only touch v, I and the timers
+    bool Jit::emit_instruction(unsigned short opcode){
+        const unsigned char x = (opcode & 0x0F00) >> 8;
+        const unsigned char y = (opcode & 0x00F0) >> 4;
+        const unsigned char kk = opcode & 0x00FF;
+        const unsigned short nnn = opcode & 0x0FFF;
+        
+        switch(opcode >> 12){
+            case 0x6:{
+                emit({0xC6, 0x47, x, kk}); //mov byte [rdi+x], kk
+                return true;
+            }
+            case 0x7:{
+                emit({0x80, 0x47, x, kk}); //add byte [rdi+x], kk
+                return true;
+            }
+            case 0x8:{
+                switch(opcode & 0x000F){
+                    case 0x0:{
+                        emit({0x0F, 0xB6, 0x47, y}); //movzx eax, byte [rdi+y]
+                        emit({0x88, 0x47, x}); //mov [rdi+x], al
+                        return true;
+                    }
+                    case 0x1:{
+                        emit({0x0F, 0xB6, 0x47, y});
+                        emit({0x08, 0x47, x}); //or [rdi+x], al
+                        return true;
+                    }
+                    case 0x2:{
+                        emit({0x0F, 0xB6, 0x47, y});
+                        emit({0x20, 0x47, x}); //and [rdi+x], al
+                        return true;
+                    }
+                    case 0x3:{
+                        emit({0x0F, 0xB6, 0x47, y});
+                        emit({0x30, 0x47, x}); //xor [rdi+x], al
+                        return true;
+                    }
+                    case 0x4:{
+                        emit({0x0F, 0xB6, 0x47, x}); //movzx eax, byte [rdi+x]
+                        emit({0x0F, 0xB6, 0x4F, y}); //movzx ecx, byte [rdi+y]
+                        emit({0x00, 0xC8}); //add al, cl
+                        emit({0x0F, 0x92, 0xC2}); //setc dl
+                        emit({0x88, 0x57, 0x0F}); //mov [rdi+15], dl
+                        emit({0x88, 0x47, x}); //mov [rdi+x], al
+                        return true;
+                    }
+                    case 0x5:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x0F, 0xB6, 0x4F, y});
+                        emit({0x38, 0xC8}); //cmp al, cl
+                        emit({0x0F, 0x97, 0xC2}); //seta dl
+                        emit({0x88, 0x57, 0x0F}); //mov [rdi+15], dl
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x0F, 0xB6, 0x4F, y});
+                        emit({0x28, 0xC8}); //sub al, cl
+                        emit({0x88, 0x47, x});
+                        return true;
+                    }
+                    case 0x6:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x24, 0x01}); //and al, 1
+                        emit({0x88, 0x47, 0x0F}); //mov [rdi+15], al
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0xD0, 0xE8}); //shr al, 1
+                        emit({0x88, 0x47, x});
+                        return true;
+                    }
+                    case 0x7:{
+                        emit({0x0F, 0xB6, 0x47, y});
+                        emit({0x0F, 0xB6, 0x4F, x});
+                        emit({0x38, 0xC8}); //cmp al, cl
+                        emit({0x0F, 0x97, 0xC2}); //seta dl
+                        emit({0x88, 0x57, 0x0F});
+                        emit({0x0F, 0xB6, 0x47, y});
+                        emit({0x0F, 0xB6, 0x4F, x});
+                        emit({0x28, 0xC8}); //sub al, cl
+                        emit({0x88, 0x47, x});
+                        return true;
+                    }
+                    case 0xE:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0xC0, 0xE8, 0x07}); //shr al, 7
+                        emit({0x88, 0x47, 0x0F});
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0xD0, 0xE0}); //shl al, 1
+                        emit({0x88, 0x47, x});
+                        return true;
+                    }
+                }
+                return false;
+            }
+            case 0xA:{
+                emit({0x66, 0x41, 0xC7, 0x02, (unsigned char)(nnn & 0xFF), (unsigned char)(nnn >> 8)}); //mov word [r10], nnn
+                return true;
+            }
+            case 0xF:{
+                switch(kk){
+                    case 0x07:{
+                        emit({0x41, 0x8B, 0x00}); //mov eax, [r8]
+                        emit({0x88, 0x47, x});
+                        return true;
+                    }
+                    case 0x15:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x41, 0x89, 0x00}); //mov [r8], eax
+                        return true;
+                    }
+                    case 0x18:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x41, 0x89, 0x01}); //mov [r9], eax
+                        return true;
+                    }
+                    case 0x1E:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x66, 0x41, 0x01, 0x02}); //add word [r10], ax
+                        return true;
+                    }
+                    case 0x29:{
+                        emit({0x0F, 0xB6, 0x47, x});
+                        emit({0x6B, 0xC0, 0x05}); //imul eax, eax, 5
+                        emit({0x66, 0x41, 0x89, 0x02}); //mov word [r10], ax
+                        return true;
+                    }
+                    case 0x65:{
+                        emit({0x41, 0x0F, 0xB7, 0x12}); //movzx edx, word [r10]
+                        for(unsigned char i = 0; i <= x; i++){
+                            emit({0x8D, 0x42, i}); //lea eax, [rdx+i]
+                            emit({0x25, 0xFF, 0x0F, 0x00, 0x00}); //and eax, 0xFFF
+                            emit({0x0F, 0xB6, 0x0C, 0x06}); //movzx ecx, byte [rsi+rax]
+                            emit({0x88, 0x4F, i}); //mov [rdi+i], cl
+                        }
+                        return true;
+                    }
+                }
+                return false;
+            }
+        }
+        return false;
+    }
+    
+    //instructions that end a block by writing pc; length is the number of instructions before this one
+    bool Jit::emit_terminator(unsigned short opcode, unsigned int length){
+        const unsigned char x = (opcode & 0x0F00) >> 8;
+        const unsigned char y = (opcode & 0x00F0) >> 4;
+        const unsigned char kk = opcode & 0x00FF;
+        const unsigned short nnn = opcode & 0x0FFF;
+        
+        switch(opcode >> 12){
+            case 0x1:{
+                emit_pc_set(nnn);
+                return true;
+            }
+            case 0x3:{
+                emit({0x80, 0x7F, x, kk}); //cmp byte [rdi+x], kk
+                emit({0x0F, 0x94, 0xC2}); //sete dl
+                break;
+            }
+            case 0x4:{
+                emit({0x80, 0x7F, x, kk});
+                emit({0x0F, 0x95, 0xC2}); //setne dl
+                break;
+            }
+            case 0x5:{
+                emit({0x0F, 0xB6, 0x47, x});
+                emit({0x3A, 0x47, y}); //cmp al, [rdi+y]
+                emit({0x0F, 0x94, 0xC2});
+                break;
+            }
+            case 0x9:{
+                emit({0x0F, 0xB6, 0x47, x});
+                emit({0x3A, 0x47, y});
+                emit({0x0F, 0x95, 0xC2});
+                break;
+            }
+            default:{
+                return false;
+            }
+        }
+        
+        //skips: pc += 2 * (length + 1) + 2 * dl, without a branch
+        const unsigned int base = 2 * (length + 1);
+        emit({0x0F, 0xB6, 0xD2}); //movzx edx, dl
+        emit({0x8D, 0x04, 0x55, (unsigned char)(base & 0xFF), (unsigned char)(base >> 8), 0x00, 0x00}); //lea eax, [rdx*2+base]
+        emit({0x66, 0x41, 0x01, 0x03}); //add word [r11], ax
+        return true;
+    }
+    
+    void Jit::emit(std::initializer_list<unsigned char> bytes){
+        out.insert(out.end(), bytes);
+    }
+    
+    void Jit::emit_pc_add(unsigned short amount){
+        emit({0x66, 0x41, 0x81, 0x03, (unsigned char)(amount & 0xFF), (unsigned char)(amount >> 8)}); //add word [r11], amount
+    }
+    
+    void Jit::emit_pc_set(unsigned short value){
+        emit({0x66, 0x41, 0xC7, 0x03, (unsigned char)(value & 0xFF), (unsigned char)(value >> 8)}); //mov word [r11], value
+    }
+}
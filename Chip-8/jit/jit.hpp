@@ -0,0 +1,70 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include<vector>
+#include<cstddef>
+#include<initializer_list>
+
+namespace chip{
+    //translates basic blocks of Chip8 code to x86-64 and caches them by start address
+    class Jit{
+        
+    public:
+        //v, memory, &I, &pc, &delay_timer, &sound_timer
+        typedef void (*Block)(unsigned char*, const unsigned char*, unsigned short*, unsigned short*, unsigned int*, unsigned int*);
+        
+        Jit();
+        ~Jit();
+        
+        //false on hosts that are not x86-64 or refuse executable memory. The code buffer is never writable and
+        //executable at once, so this also turns false if switching it between the two fails
+        bool available() const { return code_buffer != nullptr; }
+        
+        //returns the block starting at address (translating it if needed) and its length in instructions,
+        //or null if the first instruction has to go through the interpreter
+        Block lookup(unsigned short address, const unsigned char memory[4096], unsigned int& length);
+        
+        //must be called for every byte written to memory
+        void invalidate(unsigned short address){
+            if(covered[address & 0xFFF]){
+                invalidate_blocks(address & 0xFFF);
+            }
+        }
+        void flush();
+        
+    private:
+        const size_t code_capacity = 1 << 20;
+        const unsigned int max_block_length = 64;
+        
+        struct Entry{
+            Block code;
+            unsigned short length;
+            unsigned short read_bytes;
+            bool translated;
+        };
+        
+        Entry blocks[4096];
+        bool covered[4096]; //bytes that some translated (or rejected) block may have been read from
+        
+        unsigned char* code_buffer;
+        size_t code_used;
+        
+        std::vector<unsigned char> out;
+        
+        //makes the pages holding size bytes from start writable (and not executable) or executable again,
+        //releasing the whole buffer if the host refuses
+        bool protect(size_t start, size_t size, bool writable);
+        void release();
+        
+        void invalidate_blocks(unsigned short address);
+        Entry translate(unsigned short address, const unsigned char memory[4096]);
+        bool emit_instruction(unsigned short opcode);
+        bool emit_terminator(unsigned short opcode, unsigned int length);
+        
+        void emit(std::initializer_list<unsigned char> bytes);
+        void emit_pc_add(unsigned short amount);
+        void emit_pc_set(unsigned short value);
+    };
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "chip8.h"
+#include "chip.hpp"
+#include<new>
+
+//the handle is the machine itself, so every call is a single forward to it
+struct chip8_machine{
+    chip::Chip chip;
+    
+    chip8_machine(int clock_hertz) : chip(clock_hertz){}
+};
+
+chip8_machine* chip8_create(int clock_hertz){
+    //the machine allocates its frontend with a plain new, nothing may throw past the C interface
+    try{
+        return new chip8_machine(clock_hertz);
+    }
+    catch(const std::bad_alloc&){
+        return nullptr;
+    }
+}
+
+void chip8_destroy(chip8_machine* machine){
+    delete machine;
+}
+
+int chip8_load(chip8_machine* machine, const unsigned char* rom, size_t size){
+    return machine->chip.load(rom, size) ? 1 : 0;
+}
+
+int chip8_step(chip8_machine* machine, unsigned long cycles){
+    return machine->chip.step(cycles);
+}
+
+int chip8_run_frame(chip8_machine* machine){
+    return machine->chip.run_frame();
+}
+
+void chip8_set_keys(chip8_machine* machine, uint16_t keys){
+    machine->chip.set_keys(keys);
+}
+
+const uint64_t* chip8_display(const chip8_machine* machine){
+    return machine->chip.get_display().rows;
+}
+
+const uint8_t* chip8_registers(const chip8_machine* machine){
+    return machine->chip.get_registers();
+}
+
+const uint8_t* chip8_memory(const chip8_machine* machine){
+    return machine->chip.get_memory();
+}
+
+uint16_t chip8_pc(const chip8_machine* machine){
+    return machine->chip.get_pc();
+}
+
+uint16_t chip8_i(const chip8_machine* machine){
+    return machine->chip.get_I();
+}
+
+unsigned long chip8_cycles(const chip8_machine* machine){
+    return machine->chip.get_cycle_count();
+}
+
+int chip8_sound(const chip8_machine* machine){
+    return machine->chip.get_sound() ? 1 : 0;
+}
+
+void chip8_set_seed(chip8_machine* machine, unsigned int seed){
+    machine->chip.set_seed(seed);
+}
+
+int chip8_set_quirks(chip8_machine* machine, const char* profile){
+    //parsing builds strings, which allocate
+    try{
+        chip::QuirkProfile quirks;
+        if(profile == nullptr || !chip::parse_quirks(profile, quirks)){
+            return 0;
+        }
+        machine->chip.set_quirks(quirks);
+        return 1;
+    }
+    catch(const std::bad_alloc&){
+        return 0;
+    }
+}
+
+int chip8_enable_jit(chip8_machine* machine){
+    //the translator is allocated on first use
+    try{
+        return machine->chip.enable_jit() ? 1 : 0;
+    }
+    catch(const std::bad_alloc&){
+        return 0;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+//plain C interface to the interpreter, for hosts that cannot use the C++ classes. A machine is driven entirely by
+//the caller: load a ROM, then step instructions or run whole frames, setting keys and reading the screen in between.
+//Pointers returned for the screen, registers and memory stay valid for the life of the machine and always show its
+//current state; nothing is copied. A machine must only be used by one thread at a time
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_machine chip8_machine;
+
+//clock_hertz 0 uses the default of 500, null if out of memory
+chip8_machine* chip8_create(int clock_hertz);
+void chip8_destroy(chip8_machine* machine);
+
+//a fresh machine with rom copied to 0x200, 0 if it is larger than 3584 bytes
+int chip8_load(chip8_machine* machine, const unsigned char* rom, size_t size);
+
+//up to cycles instructions without ticking the timers, returns -1 or the address of an invalid opcode.
+//Before the first chip8_load the machine is empty and stops at once on the invalid opcode at 0x200
+int chip8_step(chip8_machine* machine, unsigned long cycles);
+//one 60 Hz frame: clock_hertz / 60 instructions, then one tick of the timers; returns like chip8_step
+int chip8_run_frame(chip8_machine* machine);
+
+//bit i set while key i is held
+void chip8_set_keys(chip8_machine* machine, uint16_t keys);
+
+//32 rows of 64 pixels, one word per row with the leftmost pixel in the most significant bit
+const uint64_t* chip8_display(const chip8_machine* machine);
+//V0 to VF
+const uint8_t* chip8_registers(const chip8_machine* machine);
+//all 4096 bytes
+const uint8_t* chip8_memory(const chip8_machine* machine);
+uint16_t chip8_pc(const chip8_machine* machine);
+uint16_t chip8_i(const chip8_machine* machine);
+unsigned long chip8_cycles(const chip8_machine* machine);
+//1 if the beeper sounded during the last chip8_run_frame
+int chip8_sound(const chip8_machine* machine);
+
+//seed for Cxkk, applied by the next chip8_load (0 uses the default)
+void chip8_set_seed(chip8_machine* machine, unsigned int seed);
+//"chip8", "vip", "schip" or "xochip", 0 for an unknown name or when out of memory
+int chip8_set_quirks(chip8_machine* machine, const char* profile);
+//translate hot code to native code, 0 where the host does not support it or when out of memory
+int chip8_enable_jit(chip8_machine* machine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,656 @@
+#include "lockstep.hpp"
+#include "hash.hpp"
+#include<cstring>
+#include<sstream>
+
+//Zero extends byte lanes to word lanes and keeps the low byte of word lanes. These are byte shuffles rather than
+//__builtin_convertvector, which the compiler splits into one conversion per lane, and macros rather than functions
+//because passing the wide vectors by value changes the calling convention between SSE2 and AVX builds.
+#define WIDEN(bytes) ((WordLanes)__builtin_shufflevector((ByteLanes)(bytes), ByteLanes(), \
+    0, 32, 1, 32, 2, 32, 3, 32, 4, 32, 5, 32, 6, 32, 7, 32, 8, 32, 9, 32, 10, 32, 11, 32, 12, 32, 13, 32, 14, 32, 15, 32, \
+    16, 32, 17, 32, 18, 32, 19, 32, 20, 32, 21, 32, 22, 32, 23, 32, 24, 32, 25, 32, 26, 32, 27, 32, 28, 32, 29, 32, 30, 32, 31, 32))
+#define NARROW(words) (__builtin_shufflevector((WordBytes)(words), (WordBytes)(words), \
+    0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30, 32, 34, 36, 38, 40, 42, 44, 46, 48, 50, 52, 54, 56, 58, 60, 62))
+
+namespace chip{
+    static_assert(Lockstep::chunk_lanes == 32, "WIDEN and NARROW are written out for 32 lanes");
+    
+    namespace{
+        template<typename T> bool any_set(const T& lanes){
+            unsigned long long words[sizeof(T) / 8];
+            memcpy(words, &lanes, sizeof(T));
+            unsigned long long any = 0;
+            for(size_t i = 0; i < sizeof(T) / 8; i++){
+                any |= words[i];
+            }
+            return any != 0;
+        }
+    }
+    
+    Lockstep::Lockstep(int clock_hertz){
+        this->clock_hertz = clock_hertz != 0 ? clock_hertz : Chip::default_clock_hertz;
+        lanes = 0;
+    }
+    
+    std::vector<JobResult> Lockstep::run(const std::vector<Job>& jobs){
+        std::vector<JobResult> results(jobs.size());
+        if(jobs.empty()){
+            return results;
+        }
+        
+        if(jobs[0].rom_size > 0x1000 - 0x200){
+            for(size_t i = 0; i < results.size(); i++){
+                results[i] = JobResult();
+                results[i].exit_reason = Chip::EXIT_LOAD_FAILED;
+                results[i].message = "Error: ROM could not be loaded.";
+            }
+            return results;
+        }
+        
+        reset(jobs);
+        
+        for(unsigned long frame = 0; ; frame++){
+            bool running = false;
+            for(unsigned int lane = 0; lane < lanes; lane++){
+                if(alive[lane] && cycles[lane] < jobs[lane].cycles){
+                    running = true;
+                    break;
+                }
+            }
+            if(!running){
+                break;
+            }
+            run_frame(jobs, frame);
+        }
+        
+        for(unsigned int lane = 0; lane < lanes; lane++){
+            const Chunk& chunk = chunks[lane / chunk_lanes];
+            const unsigned int i = lane % chunk_lanes;
+            JobResult& result = results[lane];
+            
+            if(alive[lane]){
+                result.exit_reason = Chip::EXIT_CYCLE_LIMIT;
+                result.message = "Cycle limit reached.";
+            }
+            else{
+                const unsigned char* lane_memory = &memory[lane * 4096];
+                const unsigned short opcode = (lane_memory[error_pc[lane] & 0xFFF] << 8) | lane_memory[(error_pc[lane] + 1) & 0xFFF];
+                std::stringstream stream;
+                stream << "Error: Opcode " << std::hex << opcode << " at memory address " << error_pc[lane] << " is invalid.";
+                result.exit_reason = Chip::EXIT_INVALID_OPCODE;
+                result.message = stream.str();
+            }
+            
+            result.display_hash = hash_bytes(display[lane].rows, sizeof(Framebuffer::rows));
+            for(int r = 0; r < 16; r++){
+                result.v[r] = chunk.v[r][i];
+            }
+            result.I = chunk.I[i];
+            result.pc = chunk.pc[i];
+            result.cycles = cycles[lane];
+        }
+        
+        return results;
+    }
+    
+    void Lockstep::reset(const std::vector<Job>& jobs){
+        lanes = jobs.size();
+        const unsigned int padded = (lanes + chunk_lanes - 1) / chunk_lanes * chunk_lanes;
+        
+        memset(code, 0, sizeof(code));
+        memcpy(code, Chip::font_set, sizeof(Chip::font_set));
+        memcpy(code + 0x200, jobs[0].rom.get(), jobs[0].rom_size);
+        memset(dirty, 0, sizeof(dirty));
+        
+        chunks.assign(padded / chunk_lanes, Chunk());
+        masks.assign(padded / chunk_lanes, Mask());
+        for(size_t c = 0; c < chunks.size(); c++){
+            chunks[c].pc += 0x200;
+        }
+        
+        memory.resize(padded * 4096);
+        for(unsigned int lane = 0; lane < padded; lane++){
+            memcpy(&memory[lane * 4096], code, sizeof(code));
+        }
+        
+        display.assign(padded, Framebuffer());
+        for(unsigned int lane = 0; lane < padded; lane++){
+            display[lane].clear();
+        }
+        keys.assign(padded, 0);
+        next_input.assign(padded, 0);
+        cycles.assign(padded, 0);
+        frame_budget.assign(padded, 0);
+        frame_left.assign(padded, 0);
+        alive.assign(padded, 0);
+        error_pc.assign(padded, -1);
+        random_state.assign(padded, Chip::default_seed);
+        
+        for(unsigned int lane = 0; lane < lanes; lane++){
+            alive[lane] = 1;
+            if(jobs[lane].seed != 0){
+                random_state[lane] = jobs[lane].seed;
+            }
+        }
+    }
+    
+    //one 60 Hz frame, with the same budget (Chip::frame_cycles), input and timer rules as Chip::run_frame
+    void Lockstep::run_frame(const std::vector<Job>& jobs, unsigned long frame){
+        const unsigned long frame_cycles = (frame + 1) * clock_hertz / 60 - frame * clock_hertz / 60;
+        
+        for(unsigned int lane = 0; lane < chunks.size() * chunk_lanes; lane++){
+            unsigned int budget = 0;
+            if(lane < lanes && alive[lane] && cycles[lane] < jobs[lane].cycles){
+                budget = frame_cycles;
+                if(budget > jobs[lane].cycles - cycles[lane]){
+                    budget = jobs[lane].cycles - cycles[lane];
+                }
+                
+                const std::vector<InputEvent>& input = jobs[lane].input;
+                while(next_input[lane] < input.size() && input[next_input[lane]].cycle <= cycles[lane]){
+                    keys[lane] = input[next_input[lane]].keys;
+                    next_input[lane]++;
+                }
+            }
+            frame_budget[lane] = budget;
+            frame_left[lane] = budget;
+        }
+        
+        //remaining is 16 bits wide so the masks stay narrow, very fast clocks run a frame in several slices
+        bool pending = true;
+        while(pending){
+            pending = false;
+            for(unsigned int lane = 0; lane < chunks.size() * chunk_lanes; lane++){
+                const unsigned int slice = frame_left[lane] < 0xFFFF ? frame_left[lane] : 0xFFFF;
+                frame_left[lane] -= slice;
+                chunks[lane / chunk_lanes].remaining[lane % chunk_lanes] = slice;
+                pending |= frame_left[lane] != 0;
+            }
+            run_slice();
+        }
+        
+        for(unsigned int lane = 0; lane < lanes; lane++){
+            if(frame_budget[lane] == 0){
+                continue;
+            }
+            cycles[lane] += frame_budget[lane];
+            
+            Chunk& chunk = chunks[lane / chunk_lanes];
+            const unsigned int i = lane % chunk_lanes;
+            if(chunk.delay_timer[i] > 0){
+                chunk.delay_timer[i]--;
+            }
+            if(chunk.sound_timer[i] > 0){
+                chunk.sound_timer[i]--;
+            }
+        }
+    }
+    
+    //runs every lane until its remaining count for this slice of the frame is used up
+    void Lockstep::run_slice(){
+        unsigned short leader;
+        while(lowest_pc(leader)){
+            unsigned int together = build_masks(leader);
+            
+            //while every lane is at the same pc, straight-line code and jumps keep them there, so the masks
+            //stay valid and only need rebuilding after a skip, a scalar instruction or a lane running out of cycles
+            bool rebuild = false;
+            while(true){
+                //lanes only disagree about code at addresses some lane has written to
+                const unsigned short at = leader & 0xFFF;
+                const unsigned short next = (leader + 1) & 0xFFF;
+                if(dirty[at] || dirty[next]){
+                    break;
+                }
+                const Chip::Instruction ins = Chip::decode((code[at] << 8) | code[next]);
+                if(!vectorizable(ins.op)){
+                    break;
+                }
+                
+                execute_vector(ins);
+                if(together <= 1 || !uniform(ins.op)){
+                    rebuild = true;
+                    break;
+                }
+                together--;
+                leader = ins.op == Chip::OP_JP ? ins.nnn : leader + 2;
+            }
+            if(rebuild){
+                continue;
+            }
+            
+            for(size_t c = 0; c < chunks.size(); c++){
+                if(!masks[c].any){
+                    continue;
+                }
+                for(unsigned int i = 0; i < chunk_lanes; i++){
+                    if(masks[c].bytes[i] == 0){
+                        continue;
+                    }
+                    
+                    const unsigned int lane = c * chunk_lanes + i;
+                    if(execute_scalar(lane)){
+                        chunks[c].remaining[i]--;
+                    }
+                    else{
+                        //the invalid opcode does not count as a cycle, and the machine stops here
+                        cycles[lane] += frame_budget[lane] - frame_left[lane] - chunks[c].remaining[i];
+                        frame_budget[lane] = 0;
+                        frame_left[lane] = 0;
+                        chunks[c].remaining[i] = 0;
+                        alive[lane] = 0;
+                        error_pc[lane] = chunks[c].pc[i];
+                    }
+                }
+            }
+        }
+    }
+    
+    //the lowest pc among lanes with cycles left in this frame, false once there are none
+    bool Lockstep::lowest_pc(unsigned short& leader) const{
+        WordLanes lowest = WordLanes() + 0xFFFF;
+        bool found = false;
+        
+        for(size_t c = 0; c < chunks.size(); c++){
+            const Chunk& chunk = chunks[c];
+            const WordLanes active = (WordLanes)(chunk.remaining != 0);
+            if(!any_set(active)){
+                continue;
+            }
+            found = true;
+            
+            const WordLanes key = chunk.pc | ~active;
+            lowest = key < lowest ? key : lowest;
+        }
+        
+        if(!found){
+            return false;
+        }
+        
+        leader = lowest[0];
+        for(unsigned int i = 1; i < chunk_lanes; i++){
+            if(lowest[i] < leader){
+                leader = lowest[i];
+            }
+        }
+        return true;
+    }
+    
+    //the masks for the lanes at leader; when every lane with cycles left is there, returns how many instructions
+    //they can all run together before the first of them runs out of cycles, otherwise 0
+    unsigned int Lockstep::build_masks(unsigned short leader){
+        bool converged = true;
+        WordLanes lowest = WordLanes() + 0xFFFF;
+        
+        for(size_t c = 0; c < chunks.size(); c++){
+            const Chunk& chunk = chunks[c];
+            Mask& mask = masks[c];
+            
+            const WordLanes active = (WordLanes)(chunk.remaining != 0);
+            mask.words = (WordLanes)(chunk.pc == leader) & active;
+            mask.bytes = NARROW(mask.words);
+            mask.any = any_set(mask.words);
+            
+            converged = converged && !any_set(active & ~mask.words);
+            const WordLanes left = chunk.remaining | ~active;
+            lowest = left < lowest ? left : lowest;
+        }
+        
+        if(!converged){
+            return 0;
+        }
+        
+        unsigned int steps = lowest[0];
+        for(unsigned int i = 1; i < chunk_lanes; i++){
+            if(lowest[i] < steps){
+                steps = lowest[i];
+            }
+        }
+        return steps;
+    }
+    
+    //vectorizable instructions that move every lane to the same next pc
+    bool Lockstep::uniform(unsigned char op){
+        return op != Chip::OP_SE_VX_KK && op != Chip::OP_SNE_VX_KK && op != Chip::OP_SE_VX_VY && op != Chip::OP_SNE_VX_VY;
+    }
+    
+    bool Lockstep::vectorizable(unsigned char op){
+        switch(op){
+            case Chip::OP_JP:
+            case Chip::OP_SE_VX_KK:
+            case Chip::OP_SNE_VX_KK:
+            case Chip::OP_SE_VX_VY:
+            case Chip::OP_LD_VX_KK:
+            case Chip::OP_ADD_VX_KK:
+            case Chip::OP_LD_VX_VY:
+            case Chip::OP_OR:
+            case Chip::OP_AND:
+            case Chip::OP_XOR:
+            case Chip::OP_ADD_VX_VY:
+            case Chip::OP_SUB:
+            case Chip::OP_SHR:
+            case Chip::OP_SUBN:
+            case Chip::OP_SHL:
+            case Chip::OP_SNE_VX_VY:
+            case Chip::OP_LD_I:
+            case Chip::OP_LD_VX_DT:
+            case Chip::OP_LD_DT_VX:
+            case Chip::OP_LD_ST_VX:
+            case Chip::OP_ADD_I_VX:
+            case Chip::OP_LD_F_VX:
+                return true;
+        }
+        return false;
+    }
+    
+    //Every operation is blended with the mask so lanes outside the group keep their values. The order of reads and
+    //writes follows Chip::execute_cycles, so overlapping registers (x == y, x == 0xF) behave identically.
+    void Lockstep::execute_vector(const Chip::Instruction& ins){
+        const unsigned char x = ins.x;
+        const unsigned char y = ins.y;
+        const unsigned char kk = ins.kk;
+        const unsigned short nnn = ins.nnn;
+        
+        for(size_t c = 0; c < chunks.size(); c++){
+            const Mask& mask = masks[c];
+            if(!mask.any){
+                continue;
+            }
+            
+            Chunk& chunk = chunks[c];
+            ByteLanes* v = chunk.v;
+            const ByteLanes m = mask.bytes;
+            WordLanes advance = mask.words & 2;
+            
+            switch(ins.op){
+                case Chip::OP_JP:{
+                    chunk.pc = (chunk.pc & ~mask.words) | (mask.words & nnn);
+                    advance = WordLanes();
+                    break;
+                }
+                case Chip::OP_SE_VX_KK:{
+                    advance += mask.words & WIDEN((ByteLanes)(v[x] == kk)) & 2;
+                    break;
+                }
+                case Chip::OP_SNE_VX_KK:{
+                    advance += mask.words & WIDEN((ByteLanes)(v[x] != kk)) & 2;
+                    break;
+                }
+                case Chip::OP_SE_VX_VY:{
+                    advance += mask.words & WIDEN((ByteLanes)(v[x] == v[y])) & 2;
+                    break;
+                }
+                case Chip::OP_SNE_VX_VY:{
+                    advance += mask.words & WIDEN((ByteLanes)(v[x] != v[y])) & 2;
+                    break;
+                }
+                case Chip::OP_LD_VX_KK:{
+                    v[x] = (v[x] & ~m) | (m & kk);
+                    break;
+                }
+                case Chip::OP_ADD_VX_KK:{
+                    v[x] += m & kk;
+                    break;
+                }
+                case Chip::OP_LD_VX_VY:{
+                    v[x] = (v[x] & ~m) | (v[y] & m);
+                    break;
+                }
+                case Chip::OP_OR:{
+                    v[x] |= v[y] & m;
+                    break;
+                }
+                case Chip::OP_AND:{
+                    v[x] &= v[y] | ~m;
+                    break;
+                }
+                case Chip::OP_XOR:{
+                    v[x] ^= v[y] & m;
+                    break;
+                }
+                case Chip::OP_ADD_VX_VY:{
+                    const ByteLanes sum = v[x] + v[y];
+                    const ByteLanes carry = (ByteLanes)(sum < v[x]) & 1;
+                    v[0xF] = (v[0xF] & ~m) | (carry & m);
+                    v[x] = (v[x] & ~m) | (sum & m);
+                    break;
+                }
+                case Chip::OP_SUB:{
+                    const ByteLanes flag = (ByteLanes)(v[x] > v[y]) & 1;
+                    v[0xF] = (v[0xF] & ~m) | (flag & m);
+                    v[x] = (v[x] & ~m) | ((v[x] - v[y]) & m);
+                    break;
+                }
+                case Chip::OP_SHR:{
+                    const ByteLanes flag = v[x] & 1;
+                    v[0xF] = (v[0xF] & ~m) | (flag & m);
+                    v[x] = (v[x] & ~m) | ((v[x] >> 1) & m);
+                    break;
+                }
+                case Chip::OP_SUBN:{
+                    const ByteLanes flag = (ByteLanes)(v[y] > v[x]) & 1;
+                    v[0xF] = (v[0xF] & ~m) | (flag & m);
+                    v[x] = (v[x] & ~m) | ((v[y] - v[x]) & m);
+                    break;
+                }
+                case Chip::OP_SHL:{
+                    const ByteLanes flag = v[x] >> 7;
+                    v[0xF] = (v[0xF] & ~m) | (flag & m);
+                    v[x] = (v[x] & ~m) | ((v[x] << 1) & m);
+                    break;
+                }
+                case Chip::OP_LD_I:{
+                    chunk.I = (chunk.I & ~mask.words) | (mask.words & nnn);
+                    break;
+                }
+                case Chip::OP_LD_VX_DT:{
+                    v[x] = (v[x] & ~m) | (chunk.delay_timer & m);
+                    break;
+                }
+                case Chip::OP_LD_DT_VX:{
+                    chunk.delay_timer = (chunk.delay_timer & ~m) | (v[x] & m);
+                    break;
+                }
+                case Chip::OP_LD_ST_VX:{
+                    chunk.sound_timer = (chunk.sound_timer & ~m) | (v[x] & m);
+                    break;
+                }
+                case Chip::OP_ADD_I_VX:{
+                    chunk.I += WIDEN(v[x]) & mask.words;
+                    break;
+                }
+                case Chip::OP_LD_F_VX:{
+                    const WordLanes font = WIDEN(v[x]) * 5;
+                    chunk.I = (chunk.I & ~mask.words) | (font & mask.words);
+                    break;
+                }
+            }
+            
+            chunk.pc += advance;
+            chunk.remaining -= mask.words & 1;
+        }
+    }
+    
+    //everything else, one lane at a time against that lane's own memory; false for an invalid opcode
+    bool Lockstep::execute_scalar(unsigned int lane){
+        Chunk& chunk = chunks[lane / chunk_lanes];
+        const unsigned int i = lane % chunk_lanes;
+        unsigned char* lane_memory = &memory[lane * 4096];
+        Framebuffer& lane_display = display[lane];
+        
+        unsigned short pc = chunk.pc[i];
+        unsigned short I = chunk.I[i];
+        unsigned char v[16];
+        for(int r = 0; r < 16; r++){
+            v[r] = chunk.v[r][i];
+        }
+        
+        const Chip::Instruction ins = Chip::decode((lane_memory[pc & 0xFFF] << 8) | lane_memory[(pc + 1) & 0xFFF]);
+        const unsigned char x = ins.x;
+        const unsigned char y = ins.y;
+        const unsigned char kk = ins.kk;
+        bool advance = true;
+        
+        switch(ins.op){
+            case Chip::OP_CLS:{
+                lane_display.clear();
+                break;
+            }
+            case Chip::OP_RET:{
+                pc = chunk.stack[chunk.stack_ptr[i] & 0xF][i];
+                chunk.stack_ptr[i]--;
+                break;
+            }
+            case Chip::OP_JP:{
+                pc = ins.nnn;
+                advance = false;
+                break;
+            }
+            case Chip::OP_CALL:{
+                chunk.stack_ptr[i]++;
+                chunk.stack[chunk.stack_ptr[i] & 0xF][i] = pc;
+                pc = ins.nnn;
+                advance = false;
+                break;
+            }
+            case Chip::OP_SE_VX_KK:{
+                if(v[x] == kk){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_SNE_VX_KK:{
+                if(v[x] != kk){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_SE_VX_VY:{
+                if(v[x] == v[y]){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_SNE_VX_VY:{
+                if(v[x] != v[y]){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_LD_VX_KK: v[x] = kk; break;
+            case Chip::OP_ADD_VX_KK: v[x] += kk; break;
+            case Chip::OP_LD_VX_VY: v[x] = v[y]; break;
+            case Chip::OP_OR: v[x] |= v[y]; break;
+            case Chip::OP_AND: v[x] &= v[y]; break;
+            case Chip::OP_XOR: v[x] ^= v[y]; break;
+            case Chip::OP_ADD_VX_VY:{
+                unsigned int ans = v[x] + v[y];
+                v[0xF] = ans > 0xFF;
+                v[x] = ans;
+                break;
+            }
+            case Chip::OP_SUB:{
+                v[0xF] = v[x] > v[y];
+                v[x] -= v[y];
+                break;
+            }
+            case Chip::OP_SHR:{
+                v[0xF] = v[x] % 2 == 1;
+                v[x] /= 2;
+                break;
+            }
+            case Chip::OP_SUBN:{
+                v[0xF] = v[y] > v[x];
+                v[x] = v[y] - v[x];
+                break;
+            }
+            case Chip::OP_SHL:{
+                v[0xF] = v[x] >= 0x80;
+                v[x] *= 2;
+                break;
+            }
+            case Chip::OP_LD_I: I = ins.nnn; break;
+            case Chip::OP_JP_V0:{
+                pc = ins.nnn + v[0];
+                advance = false;
+                break;
+            }
+            case Chip::OP_RND:{
+                unsigned char rand = Chip::next_random(random_state[lane]) % 255;
+                v[x] = kk & rand;
+                break;
+            }
+            case Chip::OP_DRW:{
+                v[0xF] = lane_display.draw(v[x], v[y], lane_memory, I, kk & 0xF);
+                break;
+            }
+            case Chip::OP_SKP:{
+                if((keys[lane] >> (v[x] & 0xF)) & 1){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_SKNP:{
+                if(!((keys[lane] >> (v[x] & 0xF)) & 1)){
+                    pc += 2;
+                }
+                break;
+            }
+            case Chip::OP_LD_VX_DT: v[x] = chunk.delay_timer[i]; break;
+            case Chip::OP_LD_VX_K:{
+                if(keys[lane] == 0){
+                    advance = false;
+                }
+                else{
+                    int key = 0;
+                    while(!((keys[lane] >> key) & 1)){
+                        key++;
+                    }
+                    v[x] = key;
+                }
+                break;
+            }
+            case Chip::OP_LD_DT_VX: chunk.delay_timer[i] = v[x]; break;
+            case Chip::OP_LD_ST_VX: chunk.sound_timer[i] = v[x]; break;
+            case Chip::OP_ADD_I_VX: I += v[x]; break;
+            case Chip::OP_LD_F_VX: I = v[x] * 5; break;
+            case Chip::OP_LD_B_VX:{
+                const unsigned char value = v[x];
+                lane_memory[I & 0xFFF] = value / 100;
+                lane_memory[(I + 1) & 0xFFF] = (value / 10) % 10;
+                lane_memory[(I + 2) & 0xFFF] = value % 10;
+                dirty[I & 0xFFF] = true;
+                dirty[(I + 1) & 0xFFF] = true;
+                dirty[(I + 2) & 0xFFF] = true;
+                break;
+            }
+            case Chip::OP_LD_I_VX:{
+                for(int r = 0; r <= x; r++){
+                    lane_memory[(I + r) & 0xFFF] = v[r];
+                    dirty[(I + r) & 0xFFF] = true;
+                }
+                break;
+            }
+            case Chip::OP_LD_VX_I:{
+                for(int r = 0; r <= x; r++){
+                    v[r] = lane_memory[(I + r) & 0xFFF];
+                }
+                break;
+            }
+            default:{
+                return false;
+            }
+        }
+        
+        if(advance){
+            pc += 2;
+        }
+        
+        chunk.pc[i] = pc;
+        chunk.I[i] = I;
+        for(int r = 0; r < 16; r++){
+            chunk.v[r][i] = v[r];
+        }
+        return true;
+    }
+}
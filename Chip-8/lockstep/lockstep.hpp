@@ -0,0 +1,79 @@
+#ifndef LOCKSTEP_HPP
+#define LOCKSTEP_HPP
+
+#include "chip.hpp"
+#include "batch.hpp"
+#include<vector>
+
+namespace chip{
+    //Runs many machines on the same ROM in lockstep. Registers live in structure-of-arrays chunks of 32 lanes so
+    //that the arithmetic opcodes, loads and skips execute as vector operations (SSE2/AVX2, depending on the target)
+    //across every lane at the same pc. Lanes that diverge wait while the lowest pc group runs, until they meet again.
+    class Lockstep{
+        
+    public:
+        static const unsigned int chunk_lanes = 32;
+        
+        Lockstep(int clock_hertz);
+        
+        //every job must use the same ROM, results[i] belongs to jobs[i]
+        std::vector<JobResult> run(const std::vector<Job>& jobs);
+        
+    private:
+        typedef unsigned char ByteLanes __attribute__((vector_size(chunk_lanes)));
+        typedef unsigned short WordLanes __attribute__((vector_size(chunk_lanes * 2)));
+        typedef unsigned char WordBytes __attribute__((vector_size(chunk_lanes * 2)));
+        
+        struct Chunk{
+            ByteLanes v[16];
+            WordLanes I;
+            WordLanes pc;
+            WordLanes stack[16];
+            ByteLanes stack_ptr;
+            ByteLanes delay_timer;
+            ByteLanes sound_timer;
+            WordLanes remaining; //cycles left in the current slice of the frame
+        };
+        
+        //which lanes of a chunk execute the current instruction, at every lane width
+        struct Mask{
+            ByteLanes bytes;
+            WordLanes words;
+            bool any;
+        };
+        
+        int clock_hertz;
+        unsigned int lanes;
+        
+        std::vector<Chunk> chunks;
+        std::vector<unsigned char> memory; //4096 bytes per lane
+        std::vector<Framebuffer> display;
+        std::vector<unsigned short> keys;
+        std::vector<size_t> next_input;
+        std::vector<unsigned int> random_state;
+        std::vector<unsigned long> cycles;
+        std::vector<unsigned int> frame_budget;
+        std::vector<unsigned int> frame_left; //budget not yet handed out to a slice
+        std::vector<unsigned char> alive;
+        std::vector<int> error_pc;
+        std::vector<Mask> masks;
+        
+        //the ROM image every lane started with, and the bytes any lane has written since
+        unsigned char code[4096];
+        bool dirty[4096];
+        
+        void reset(const std::vector<Job>& jobs);
+        void run_frame(const std::vector<Job>& jobs, unsigned long frame);
+        void run_slice();
+        
+        bool lowest_pc(unsigned short& leader) const;
+        unsigned int build_masks(unsigned short leader);
+        
+        static bool vectorizable(unsigned char op);
+        static bool uniform(unsigned char op);
+        void execute_vector(const Chip::Instruction& ins);
+        bool execute_scalar(unsigned int lane);
+    };
+}
+
+#endif
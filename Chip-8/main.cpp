@@ -1,23 +1,746 @@
 #include "chip.hpp"
+#if CHIP8_SDL
+#include "sdl_frontend.hpp"
+#endif
+#include "headless_frontend.hpp"
+#include "batch.hpp"
+#include "replay.hpp"
+#include "hash.hpp"
+#include "archive.hpp"
+#include "debugger.hpp"
+#include "metrics.hpp"
+#include<cstring>
+#include<map>
+#include<iomanip>
+#include<random>
+#include<csignal>
 
 //Command line argument #1: Full path to a valid Chip8 binary file
 //Command line argument #2 (optional): Clock cycles per second. (The default is 500 if nothing is specified)
+//Options (may appear anywhere after the program name):
+//  --headless      Run without a window or keyboard, as fast as possible
+//  --frames N      Headless only: stop after N frames (60 frames per emulated second)
+//  --cycles N      Headless only: stop after N cycles
+//  --dump FILE     Headless only: write the final framebuffer to FILE ("-" for standard output)
+//  --jit           Translate hot code to native x86-64 code (falls back to the interpreter elsewhere)
+//  --batch FILE    Run every job listed in FILE headless on all cores instead of a single game (see run_batch)
+//  --archive FILE  Batch only: take ROMs named @<hex hash> in the batch file from the ROM archive FILE
+//  --pack FILE     Pack the ROMs listed on standard input, one path per line, into the archive FILE and print their hashes
+//  --threads N     Batch only: number of worker threads (default: all hardware threads)
+//  --lockstep N    Batch only: run jobs that share a ROM N at a time on the SIMD lockstep interpreter
+//  --speed X       Run the window at X times the clock speed (default 1)
+//  --unlimited     Run the window as fast as possible, same as --speed 0
+//  --turbo         Fast-forward the whole run (holding tab fast-forwards in the window)
+//  --turbo-speed X Fast-forward at X times the clock speed, 0 (the default) as fast as possible
+//  --frame-skip K  Present only every Kth frame while fast-forwarding (default: about 60 per second)
+//  --sound-log FILE  Write when the beeper turns on and off to FILE, one "<frame> on|off" line per change (headless only)
+//  --stats         Print the measured clock speed, frame timing jitter and dropped or repeated frames when the game stops
+//  --trace FILE    Record every executed instruction to FILE in a compact binary format
+//  --decode FILE   Print a trace recorded with --trace as text and exit
+//  --rewind MB     Keep MB megabytes of history to rewind through by holding backspace
+//  --save-state FILE  Write the machine state to FILE when the game stops
+//  --load-state FILE  Continue from a state written with --save-state instead of starting the ROM from scratch
+//  --profile FILE  Write where the ROM spent its instructions (addresses, opcodes, loops, subroutines) and host time to FILE, - for stdout
+//  --profile-stacks FILE  Write the subroutine call stacks in folded form for flamegraph.pl
+//  --seed N        Seed for the random number instruction (Cxkk)
+//  --quirks NAME   Behave like another implementation: chip8 (the default), vip, schip or xochip (see quirks.hpp)
+//  --quirks-db FILE  Pick the quirk profile by ROM hash (shown by --stats) from FILE, lines of "<hex hash> <profile>";
+//                  --quirks overrides it
+//  --record FILE   Log the seed and every key change to FILE, with a hash of the final state to verify replays against
+//                  (not with --load-state: replays start from the ROM)
+//  --replay FILE   Run a recording made with --record headless at full speed and check that it ends the same way
+//  --debug         Run the game headless under the interactive debugger on the terminal (commands in debugger.hpp)
+//  --metrics DEST  Write throughput and host time samples while running, to a file or with unix:PATH as datagrams to a socket
+//  --metrics-interval S  Seconds between metrics samples (default 1)
+//  --overlay       Show the metrics samples in the corner of the window (with --metrics, or on their own)
+
+//--quirks wins over the database, which wins over the original behaviour
+static chip::QuirkProfile select_quirks(unsigned long long rom_hash, const chip::QuirkProfile* forced, const chip::QuirksDatabase& database){
+    chip::QuirkProfile profile = chip::QUIRKS_CHIP8;
+    if(forced != nullptr){
+        profile = *forced;
+    }
+    else{
+        database.lookup(rom_hash, profile);
+    }
+    return profile;
+}
+
+//Each line of a batch file is "<rom path> <cycle budget> [<cycle>:<hex key mask> ...]", blank lines and lines starting with # are skipped.
+//With --archive the ROM can also be "@<hex hash>" for one ROM in the archive, or "@*" to run the line on every ROM in it.
+//One result line is printed per job, in the order of the file.
+static int run_batch(std::string batch_path, std::string archive_path, unsigned int threads, unsigned int lockstep_lanes, int cycles,
+    bool use_jit, const chip::QuirkProfile* forced_quirks, const chip::QuirksDatabase& quirks_db){
+    std::ifstream file(batch_path);
+    if(!file){
+        std::cout << "Batch file could not be opened." << std::endl;
+        return 1;
+    }
+
+    //jobs point straight into the mapped archive, the only copy made of its ROMs is into each machine's memory
+    std::shared_ptr<chip::RomArchive> archive;
+    if(!archive_path.empty()){
+        archive = std::make_shared<chip::RomArchive>();
+        std::string error;
+        if(!archive->open(archive_path, error)){
+            std::cout << "Invalid ROM archive " << archive_path << ", " << error << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<chip::Job> jobs;
+    std::vector<std::string> names;
+    std::map<std::string, std::shared_ptr<const std::vector<unsigned char>>> roms;
+
+    auto add_job = [&](chip::Job job, std::shared_ptr<const unsigned char> rom, size_t size, unsigned long long hash, std::string name){
+        job.rom = rom;
+        job.rom_size = size;
+        job.quirks = select_quirks(hash, forced_quirks, quirks_db);
+        jobs.push_back(job);
+        names.push_back(name);
+    };
+
+    std::string line;
+    while(std::getline(file, line)){
+        if(line.empty() || line[0] == '#'){
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string rom_path;
+        chip::Job job;
+        job.seed = 0;
+        if(!(fields >> rom_path >> job.cycles) || job.cycles == 0){
+            std::cout << "Invalid batch line: " << line << std::endl;
+            return 1;
+        }
+
+        std::string event;
+        while(fields >> event){
+            size_t colon = event.find(':');
+            if(colon == std::string::npos){
+                std::cout << "Invalid input event: " << event << std::endl;
+                return 1;
+            }
+            chip::InputEvent input;
+            input.cycle = strtoul(event.substr(0, colon).c_str(), nullptr, 10);
+            input.keys = strtoul(event.substr(colon + 1).c_str(), nullptr, 16);
+            job.input.push_back(input);
+        }
+
+        if(rom_path[0] == '@'){
+            if(!archive){
+                std::cout << "Archive ROM without --archive: " << rom_path << std::endl;
+                return 1;
+            }
+            size_t size;
+            if(rom_path == "@*"){
+                for(size_t r = 0; r < archive->size(); r++){
+                    const unsigned char* rom = archive->get_rom(r, size);
+                    std::ostringstream name;
+                    name << '@' << std::hex << std::setfill('0') << std::setw(16) << archive->get_hash(r);
+                    add_job(job, std::shared_ptr<const unsigned char>(archive, rom), size, archive->get_hash(r), name.str());
+                }
+                continue;
+            }
+            char* end;
+            const unsigned long long hash = strtoull(rom_path.c_str() + 1, &end, 16);
+            const unsigned char* rom = *end == '\0' ? archive->find(hash, size) : nullptr;
+            if(rom == nullptr){
+                std::cout << "ROM not in the archive: " << rom_path << std::endl;
+                return 1;
+            }
+            add_job(job, std::shared_ptr<const unsigned char>(archive, rom), size, hash, rom_path);
+            continue;
+        }
+
+        //every job running the same ROM shares one copy of it
+        std::shared_ptr<const std::vector<unsigned char>>& rom = roms[rom_path];
+        if(!rom){
+            std::ifstream f(rom_path, std::ios::binary);
+            if(!f){
+                std::cout << "ROM could not be loaded: " << rom_path << std::endl;
+                return 1;
+            }
+            rom = std::make_shared<const std::vector<unsigned char>>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+        add_job(job, std::shared_ptr<const unsigned char>(rom, rom->data()), rom->size(), chip::hash_bytes(rom->data(), rom->size()), rom_path);
+    }
+
+    chip::BatchRunner runner(threads, cycles);
+    runner.set_lockstep(lockstep_lanes);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<chip::JobResult> results = runner.run(jobs, use_jit);
+    auto end = std::chrono::steady_clock::now();
+
+    unsigned long long total_cycles = 0;
+    for(size_t i = 0; i < results.size(); i++){
+        const chip::JobResult& result = results[i];
+        total_cycles += result.cycles;
+
+        std::cout << names[i] << std::hex << std::setfill('0')
+            << " hash=" << std::setw(16) << result.display_hash
+            << " pc=" << std::setw(3) << result.pc
+            << " I=" << std::setw(3) << result.I << " v=";
+        for(int r = 0; r < 16; r++){
+            std::cout << std::setw(2) << (int)result.v[r];
+        }
+        std::cout << std::dec << " cycles=" << result.cycles << " " << result.message << std::endl;
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cerr << jobs.size() << " jobs on " << runner.get_threads() << " threads in " << seconds << " s, "
+        << total_cycles / seconds / 1e6 << " million cycles/s" << std::endl;
+
+    return 0;
+}
+
+static bool read_file(std::string path, std::vector<unsigned char>& data){
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+//packs the ROMs whose paths are on standard input and prints "<hash> <path>" for each, to refer to them as @<hash>
+static int pack_archive(std::string archive_path){
+    std::vector<std::vector<unsigned char>> roms;
+    std::vector<std::string> paths;
+    std::string path;
+    while(std::getline(std::cin, path)){
+        if(path.empty()){
+            continue;
+        }
+        roms.push_back(std::vector<unsigned char>());
+        if(!read_file(path, roms.back())){
+            std::cout << "ROM could not be loaded: " << path << std::endl;
+            return 1;
+        }
+        paths.push_back(path);
+    }
+
+    std::string error;
+    if(!chip::RomArchive::write(archive_path, roms, error)){
+        std::cout << "ROM archive " << archive_path << " not written, " << error << std::endl;
+        return 1;
+    }
+    for(size_t i = 0; i < roms.size(); i++){
+        std::cout << std::hex << std::setfill('0') << std::setw(16) << chip::hash_bytes(roms[i].data(), roms[i].size())
+            << std::dec << " " << paths[i] << std::endl;
+    }
+    return 0;
+}
+
+//Ctrl+C stops a running continue and returns to the prompt instead of ending the program
+static chip::Debugger* active_debugger = nullptr;
+
+static void interrupt_debugger(int){
+    active_debugger->interrupt();
+}
+
+static int run_debugger(std::string game_path, int cycles, unsigned int seed, bool use_jit, const chip::QuirkProfile* forced_quirks,
+    const chip::QuirksDatabase& quirks_db){
+    std::vector<unsigned char> rom;
+    if(!read_file(game_path, rom)){
+        std::cout << "ROM could not be loaded: " << game_path << std::endl;
+        return 1;
+    }
+
+    chip::Chip c(cycles);
+    c.set_seed(seed);
+    c.set_quirks(select_quirks(chip::hash_bytes(rom.data(), rom.size()), forced_quirks, quirks_db));
+    if(use_jit && !c.enable_jit()){
+        std::cout << "JIT is not supported on this host, using the interpreter." << std::endl;
+    }
+    if(!c.load(rom.data(), rom.size())){
+        std::cout << "ROM could not be loaded: " << game_path << std::endl;
+        return 1;
+    }
+
+    chip::Debugger debugger(c);
+    active_debugger = &debugger;
+    std::signal(SIGINT, interrupt_debugger);
+    debugger.repl(std::cin, std::cout);
+    std::signal(SIGINT, SIG_DFL);
+    active_debugger = nullptr;
+    return 0;
+}
+
+//reruns a recording on the headless path, returns 0 if it ends in exactly the recorded state
+static int run_replay(std::string replay_path, std::string game_path, bool use_jit, chip::Profiler* profiler,
+    const chip::QuirkProfile* forced_quirks, const chip::QuirksDatabase& quirks_db){
+    chip::Recording recording;
+    if(!recording.load(replay_path)){
+        std::cout << "Not a recording: " << replay_path << std::endl;
+        return 1;
+    }
+    if(recording.cycles == 0){
+        std::cout << "The recording is empty." << std::endl;
+        return 1;
+    }
+
+    std::vector<unsigned char> rom;
+    if(!read_file(game_path, rom)){
+        std::cout << "ROM could not be loaded: " << game_path << std::endl;
+        return 1;
+    }
+    if(chip::hash_bytes(rom.data(), rom.size()) != recording.rom_hash){
+        std::cout << "The recording was made with a different ROM." << std::endl;
+        return 1;
+    }
+
+    chip::HeadlessFrontend frontend(0, recording.cycles);
+    frontend.set_input(&recording.input);
+    chip::Chip c(recording.clock_hertz, frontend);
+    c.set_seed(recording.seed);
+    c.set_quirks(select_quirks(recording.rom_hash, forced_quirks, quirks_db));
+    c.set_profiler(profiler);
+    if(use_jit && !c.enable_jit()){
+        std::cout << "JIT is not supported on this host, using the interpreter." << std::endl;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    c.run(rom.data(), rom.size());
+    auto end = std::chrono::steady_clock::now();
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    const double played = (double)recording.cycles / recording.clock_hertz;
+    std::cout << "Replayed " << c.get_cycle_count() << " cycles (" << played << " s of play) in " << seconds << " s, "
+        << played / seconds << " times real time." << std::endl;
+
+    if(c.get_cycle_count() != recording.cycles || chip::hash_machine(c) != recording.final_hash){
+        std::cout << "Replay diverged from the recording." << std::endl;
+        return 1;
+    }
+    std::cout << "Replay matches the recording." << std::endl;
+    return 0;
+}
+
+static bool write_state(std::string path, const chip::Chip& c){
+    chip::MachineState state;
+    c.save_state(state);
+    std::vector<unsigned char> data = state.serialize();
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if(!out){
+        std::cout << "State could not be saved to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool write_profile(const chip::Profiler& profiler, std::string report_path, std::string stacks_path){
+    if(report_path == "-"){
+        profiler.report(std::cout);
+    }
+    else if(!report_path.empty()){
+        std::ofstream out(report_path);
+        profiler.report(out);
+        if(!out){
+            std::cout << "Profile could not be saved to " << report_path << std::endl;
+            return false;
+        }
+    }
+    if(!stacks_path.empty()){
+        std::ofstream out(stacks_path);
+        profiler.write_folded(out);
+        if(!out){
+            std::cout << "Call stacks could not be saved to " << stacks_path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_turbo(const chip::Chip::FrameStats& stats){
+    if(stats.turbo_frames == 0 || stats.seconds <= 0){
+        return;
+    }
+    //60 emulated frames are one second of play
+    std::cout << "Fast-forwarded " << stats.turbo_frames << " of " << stats.frames << " frames, " << stats.frames / 60.0 / stats.seconds
+        << " times real time overall, " << stats.presented << " frames presented." << std::endl;
+}
+
+static void print_stats(const chip::Chip& c){
+    const chip::Chip::FrameStats& stats = c.get_frame_stats();
+    std::cout << stats.frames << " frames in " << stats.seconds << " s, effective clock " << stats.effective_hertz << " Hz, "
+        << chip::quirks_name(c.get_quirks()) << " quirks";
+    if(stats.idle_cycles > 0){
+        std::cout << ", " << stats.idle_cycles << " idle cycles skipped";
+    }
+    if(stats.fused_pairs > 0 && c.get_cycle_count() > 0){
+        std::cout << ", " << stats.fused_pairs << " fused pairs (" << 200.0 * stats.fused_pairs / c.get_cycle_count() << "% of instructions)";
+    }
+    if(stats.jitter_max_us > 0){
+        std::cout << ", frame jitter mean " << stats.jitter_mean_us << " us, max " << stats.jitter_max_us << " us";
+    }
+    std::cout << std::endl;
+}
+
 int main(int argc, char *argv[]) {
-    if(argc < 2){
+    std::string game_path;
+    int cycles = 0;
+    bool headless = false;
+    unsigned long max_frames = 0;
+    unsigned long max_cycles = 0;
+    std::string dump_path;
+    bool use_jit = false;
+    std::string batch_path;
+    std::string archive_path;
+    std::string pack_path;
+    bool debug = false;
+    unsigned int threads = 0;
+    unsigned int lockstep_lanes = 0;
+    double speed = 1;
+    bool turbo = false;
+    double turbo_speed = 0;
+    unsigned int frame_skip = 0;
+    bool stats = false;
+    std::string trace_path;
+    std::string decode_path;
+    double rewind_mb = 0;
+    std::string save_state_path;
+    std::string load_state_path;
+    unsigned int seed = 0;
+    std::string record_path;
+    std::string replay_path;
+    std::string profile_path;
+    std::string sound_log_path;
+    std::string profile_stacks_path;
+    std::string quirks_name;
+    std::string quirks_db_path;
+    std::string metrics_destination;
+    double metrics_interval = 1;
+    bool overlay = false;
+
+    int positional = 0;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--headless") == 0){
+            headless = true;
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc){
+            max_frames = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "--cycles") == 0 && i + 1 < argc){
+            max_cycles = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "--dump") == 0 && i + 1 < argc){
+            dump_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--jit") == 0){
+            use_jit = true;
+        }
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc){
+            batch_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--archive") == 0 && i + 1 < argc){
+            archive_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--pack") == 0 && i + 1 < argc){
+            pack_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--debug") == 0){
+            debug = true;
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+            threads = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc){
+            lockstep_lanes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "--sound-log") == 0 && i + 1 < argc){
+            sound_log_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--turbo") == 0){
+            turbo = true;
+        }
+        else if(strcmp(argv[i], "--turbo-speed") == 0 && i + 1 < argc){
+            turbo_speed = strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--frame-skip") == 0 && i + 1 < argc){
+            frame_skip = strtoul(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc){
+            speed = strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--unlimited") == 0){
+            speed = 0;
+        }
+        else if(strcmp(argv[i], "--stats") == 0){
+            stats = true;
+        }
+        else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc){
+            trace_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--decode") == 0 && i + 1 < argc){
+            decode_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--rewind") == 0 && i + 1 < argc){
+            rewind_mb = strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--save-state") == 0 && i + 1 < argc){
+            save_state_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--load-state") == 0 && i + 1 < argc){
+            load_state_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+            profile_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--profile-stacks") == 0 && i + 1 < argc){
+            profile_stacks_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+            seed = strtoul(argv[++i], nullptr, 0);
+        }
+        else if(strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+            record_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc){
+            replay_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--quirks") == 0 && i + 1 < argc){
+            quirks_name = argv[++i];
+        }
+        else if(strcmp(argv[i], "--quirks-db") == 0 && i + 1 < argc){
+            quirks_db_path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--metrics") == 0 && i + 1 < argc){
+            metrics_destination = argv[++i];
+        }
+        else if(strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc){
+            metrics_interval = strtod(argv[++i], nullptr);
+        }
+        else if(strcmp(argv[i], "--overlay") == 0){
+            overlay = true;
+        }
+        else if(positional == 0){
+            game_path = argv[i];
+            positional++;
+        }
+        else if(positional == 1){
+            cycles = atoi(argv[i]);
+            positional++;
+        }
+    }
+
+    if(!pack_path.empty()){
+        return pack_archive(pack_path);
+    }
+
+    if(!decode_path.empty()){
+        std::ifstream in(decode_path, std::ios::binary);
+        if(!chip::Tracer::decode(in, std::cout)){
+            std::cout << "Not a trace file: " << decode_path << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    chip::QuirkProfile forced_quirks;
+    if(!quirks_name.empty() && !chip::parse_quirks(quirks_name, forced_quirks)){
+        std::cout << "Unknown quirk profile: " << quirks_name << " (use chip8, vip, schip or xochip)" << std::endl;
+        return 1;
+    }
+    const chip::QuirkProfile* forced = quirks_name.empty() ? nullptr : &forced_quirks;
+    chip::QuirksDatabase quirks_db;
+    if(!quirks_db_path.empty()){
+        std::ifstream in(quirks_db_path);
+        std::string error;
+        if(!in){
+            std::cout << "Quirk database could not be opened: " << quirks_db_path << std::endl;
+            return 1;
+        }
+        if(!quirks_db.load(in, error)){
+            std::cout << "Invalid quirk database " << quirks_db_path << ", " << error << std::endl;
+            return 1;
+        }
+    }
+
+    if(!batch_path.empty()){
+        return run_batch(batch_path, archive_path, threads, lockstep_lanes, cycles, use_jit, forced, quirks_db);
+    }
+
+    if(game_path.empty()){
         std::cout << "No game selected. Use the command line arguments to select a Chip8 binary file from your system." << std::endl;
         return 1;
     }
-    
-    std::string game_path = argv[1];
-    int cycles = 0;
-    if(argc >= 3){
-        cycles = atoi(argv[2]);
+
+    if(debug){
+        return run_debugger(game_path, cycles, seed, use_jit, forced, quirks_db);
     }
 
-    chip::Chip c(cycles);
+    chip::Profiler profiler;
+    const bool profiling = !profile_path.empty() || !profile_stacks_path.empty();
+
+    if(!replay_path.empty()){
+        const int result = run_replay(replay_path, game_path, use_jit, profiling ? &profiler : nullptr, forced, quirks_db);
+        if(profiling && !write_profile(profiler, profile_path, profile_stacks_path)){
+            return 1;
+        }
+        return result;
+    }
 
-    std::string msg = c.run(game_path);
+    //a recording replays from the ROM's start, one that resumed a save state could never match
+    if(!record_path.empty() && !load_state_path.empty()){
+        std::cout << "--record cannot be combined with --load-state, recordings always start from the ROM." << std::endl;
+        return 1;
+    }
+
+    chip::MachineState resume;
+    if(!load_state_path.empty()){
+        std::vector<unsigned char> data;
+        if(!read_file(load_state_path, data) || !resume.deserialize(data.data(), data.size())){
+            std::cout << "Not a save state: " << load_state_path << std::endl;
+            return 1;
+        }
+    }
+
+    chip::Tracer tracer;
+    if(!trace_path.empty() && !tracer.open(trace_path)){
+        std::cout << "Trace file could not be opened." << std::endl;
+        return 1;
+    }
+
+    chip::HeadlessFrontend headless_frontend(max_frames, max_cycles);
+    std::vector<chip::SoundEvent> sound_log;
+    if(!sound_log_path.empty()){
+        headless_frontend.set_sound_log(&sound_log);
+    }
+#if CHIP8_SDL
+    chip::SdlFrontend sdl_frontend;
+#endif
+    chip::Frontend* frontend = &headless_frontend;
+    if(!headless){
+#if CHIP8_SDL
+        frontend = &sdl_frontend;
+#else
+        std::cout << "This build has no window, run with --headless." << std::endl;
+        return 1;
+#endif
+    }
+
+    //the publisher goes before the frontend its listener draws into
+    chip::Metrics metrics;
+    chip::MetricsPublisher publisher(metrics, metrics_interval);
+    const bool measuring = !metrics_destination.empty() || (overlay && !headless);
+    if(!metrics_destination.empty()){
+        std::string error;
+        if(!publisher.open(metrics_destination, error)){
+            std::cout << "Metrics destination " << metrics_destination << " cannot be used: " << error << std::endl;
+            return 1;
+        }
+    }
+#if CHIP8_SDL
+    if(overlay && !headless){
+        sdl_frontend.set_overlay(true);
+        publisher.set_listener([&sdl_frontend](const chip::MetricsSample& sample){ sdl_frontend.show_metrics(sample); });
+    }
+#endif
+
+    //recording wraps whichever frontend is in use, every run it records is reproducible from a fresh seed
+    chip::Recording recording;
+    chip::RecordingFrontend recorder(*frontend, recording);
+    if(!record_path.empty()){
+        frontend = &recorder;
+        if(seed == 0){
+            seed = std::random_device()();
+        }
+    }
+
+    chip::Chip c(cycles, *frontend);
+    c.set_speed(speed);
+    c.set_turbo(turbo_speed, frame_skip, turbo);
+    c.set_seed(seed);
+    //a ROM that cannot be read is reported by run
+    std::vector<unsigned char> rom;
+    if(forced != nullptr || quirks_db.size() != 0 || stats){
+        read_file(game_path, rom);
+        c.set_quirks(select_quirks(chip::hash_bytes(rom.data(), rom.size()), forced, quirks_db));
+    }
+    if(!trace_path.empty()){
+        c.set_tracer(&tracer);
+    }
+    if(!load_state_path.empty()){
+        c.set_resume_state(&resume);
+    }
+    if(profiling){
+        c.set_profiler(&profiler);
+    }
+    if(record_path.empty()){
+        c.enable_rewind(rewind_mb * 1024 * 1024);
+    }
+    if(use_jit && !c.enable_jit()){
+        std::cout << "JIT is not supported on this host, using the interpreter." << std::endl;
+    }
+    if(measuring){
+        c.set_metrics(&metrics);
+        publisher.start();
+    }
+
+    std::string msg;
+    if(headless){
+        msg = c.run(game_path);
+    }
+#if CHIP8_SDL
+    else{
+        //the window has to stay on the main thread, the machine runs on another one
+        msg = sdl_frontend.run([&c, &game_path](){ return c.run(game_path); });
+    }
+#endif
+    publisher.stop();
     std::cout << "\n" << msg << std::endl;
-    
+    print_turbo(c.get_frame_stats());
+    if(stats){
+        print_stats(c);
+        //the key to list the ROM under in a --quirks-db file
+        std::cout << "ROM hash " << std::hex << std::setw(16) << std::setfill('0') << chip::hash_bytes(rom.data(), rom.size())
+            << std::dec << std::setfill(' ') << std::endl;
+#if CHIP8_SDL
+        if(!headless){
+            std::cout << sdl_frontend.get_published_frames() << " frames rendered, " << sdl_frontend.get_dropped_frames() << " dropped, "
+                << sdl_frontend.get_duplicated_frames() << " refreshes repeated the previous frame" << std::endl;
+        }
+#endif
+    }
+    if(profiling && !write_profile(profiler, profile_path, profile_stacks_path)){
+        return 1;
+    }
+    if(!save_state_path.empty() && !write_state(save_state_path, c)){
+        return 1;
+    }
+
+    if(!record_path.empty()){
+        read_file(game_path, rom);
+        recording.seed = c.get_seed();
+        recording.clock_hertz = c.get_clock_hertz();
+        recording.rom_hash = chip::hash_bytes(rom.data(), rom.size());
+        recording.cycles = c.get_cycle_count();
+        recording.final_hash = chip::hash_machine(c);
+        if(!recording.save(record_path)){
+            std::cout << "Recording could not be saved to " << record_path << std::endl;
+            return 1;
+        }
+    }
+
+    if(!sound_log_path.empty()){
+        std::ofstream out(sound_log_path);
+        for(size_t i = 0; i < sound_log.size(); i++){
+            out << sound_log[i].frame << (sound_log[i].on ? " on" : " off") << "\n";
+        }
+    }
+
+    if(dump_path == "-"){
+        chip::HeadlessFrontend::dump_display(std::cout, c.get_display());
+    }
+    else if(!dump_path.empty()){
+        std::ofstream out(dump_path);
+        chip::HeadlessFrontend::dump_display(out, c.get_display());
+    }
+
     return 0;
 }
@@ -0,0 +1,188 @@
+#include "metrics.hpp"
+#include<sstream>
+#include<iomanip>
+#include<chrono>
+#include<cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define METRICS_SOCKET 1
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
+#else
+#define METRICS_SOCKET 0
+#endif
+
+namespace chip{
+    namespace{
+        //the counters at one moment
+        struct Snapshot{
+            uint64_t instructions;
+            uint64_t frames;
+            uint64_t presented;
+            uint64_t dropped;
+            uint64_t interpret_ns;
+            uint64_t display_ns;
+            uint64_t keys_ns;
+            uint64_t sleep_ns;
+            uint64_t overshoot_ns;
+            uint64_t paced_frames;
+        };
+        
+        Snapshot take(const Metrics& m){
+            Snapshot s;
+            s.instructions = m.instructions.load(std::memory_order_relaxed);
+            s.frames = m.frames.load(std::memory_order_relaxed);
+            s.presented = m.presented.load(std::memory_order_relaxed);
+            s.dropped = m.dropped.load(std::memory_order_relaxed);
+            s.interpret_ns = m.interpret_ns.load(std::memory_order_relaxed);
+            s.display_ns = m.display_ns.load(std::memory_order_relaxed);
+            s.keys_ns = m.keys_ns.load(std::memory_order_relaxed);
+            s.sleep_ns = m.sleep_ns.load(std::memory_order_relaxed);
+            s.overshoot_ns = m.overshoot_ns.load(std::memory_order_relaxed);
+            s.paced_frames = m.paced_frames.load(std::memory_order_relaxed);
+            return s;
+        }
+    }
+    
+    Metrics::Metrics() : instructions(0), frames(0), presented(0), dropped(0), interpret_ns(0), display_ns(0), keys_ns(0),
+        sleep_ns(0), overshoot_ns(0), paced_frames(0), timer_lag_ns(0){}
+    
+    std::string MetricsSample::format() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3) << "time=" << time
+            << std::setprecision(0) << " ips=" << instructions_per_second
+            << std::setprecision(1) << " fps=" << frames_per_second << " presented=" << presented_per_second
+            << " dropped=" << dropped
+            << " interpret=" << 100 * interpret << "% display=" << 100 * display << "% keys=" << 100 * keys
+            << "% sleep=" << 100 * sleep << "%"
+            << std::setprecision(0) << " overshoot_us=" << overshoot_us << " timer_lag_us=" << timer_lag_us;
+        return out.str();
+    }
+    
+    MetricsPublisher::MetricsPublisher(const Metrics& metrics, double interval_seconds) : metrics(metrics){
+        this->interval_seconds = interval_seconds > 0 ? interval_seconds : 1;
+        socket_fd = -1;
+        running = false;
+    }
+    
+    MetricsPublisher::~MetricsPublisher(){
+        stop();
+#if METRICS_SOCKET
+        if(socket_fd != -1){
+            close(socket_fd);
+        }
+#endif
+    }
+    
+    bool MetricsPublisher::open(std::string destination, std::string& error){
+        if(destination.compare(0, 5, "unix:") == 0){
+#if METRICS_SOCKET
+            socket_path = destination.substr(5);
+            sockaddr_un address;
+            if(socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)){
+                error = "socket path is empty or too long";
+                return false;
+            }
+            socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+            if(socket_fd == -1){
+                error = "socket could not be created";
+                return false;
+            }
+            return true;
+#else
+            error = "UNIX sockets are not supported on this host";
+            return false;
+#endif
+        }
+        
+        file.open(destination);
+        if(!file){
+            error = "file could not be opened";
+            return false;
+        }
+        return true;
+    }
+    
+    void MetricsPublisher::start(){
+        if(running){
+            return;
+        }
+        running = true;
+        thread = std::thread(&MetricsPublisher::publish, this);
+    }
+    
+    void MetricsPublisher::stop(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!running){
+                return;
+            }
+            running = false;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+    
+    void MetricsPublisher::publish(){
+        typedef std::chrono::steady_clock clock;
+        const clock::time_point start = clock::now();
+        const clock::duration interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(interval_seconds));
+        clock::time_point last_time = start;
+        clock::time_point deadline = start;
+        Snapshot last = take(metrics);
+        
+        std::unique_lock<std::mutex> lock(mutex);
+        while(running){
+            deadline += interval;
+            if(wake.wait_until(lock, deadline, [this]{ return !running; })){
+                break;
+            }
+            
+            const clock::time_point now = clock::now();
+            const Snapshot current = take(metrics);
+            const double seconds = std::chrono::duration<double>(now - last_time).count();
+            const double ns = seconds * 1e9;
+            
+            MetricsSample sample;
+            sample.time = std::chrono::duration<double>(now - start).count();
+            sample.instructions_per_second = (current.instructions - last.instructions) / seconds;
+            sample.frames_per_second = (current.frames - last.frames) / seconds;
+            sample.presented_per_second = (current.presented - last.presented) / seconds;
+            sample.dropped = current.dropped - last.dropped;
+            sample.interpret = (current.interpret_ns - last.interpret_ns) / ns;
+            sample.display = (current.display_ns - last.display_ns) / ns;
+            sample.keys = (current.keys_ns - last.keys_ns) / ns;
+            sample.sleep = (current.sleep_ns - last.sleep_ns) / ns;
+            const uint64_t paced = current.paced_frames - last.paced_frames;
+            sample.overshoot_us = paced != 0 ? (current.overshoot_ns - last.overshoot_ns) / 1e3 / paced : 0;
+            sample.timer_lag_us = metrics.timer_lag_ns.load(std::memory_order_relaxed) / 1e3;
+            last = current;
+            last_time = now;
+            
+            //writing and the listener happen outside the lock, stop only has to wait for them to finish
+            lock.unlock();
+            write(sample.format() + "\n");
+            if(listener){
+                listener(sample);
+            }
+            lock.lock();
+        }
+    }
+    
+    void MetricsPublisher::write(const std::string& line){
+#if METRICS_SOCKET
+        if(socket_fd != -1){
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+            sendto(socket_fd, line.data(), line.size(), MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            return;
+        }
+#endif
+        if(file.is_open()){
+            file << line << std::flush;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include<atomic>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<fstream>
+#include<string>
+#include<cstdint>
+
+namespace chip{
+    //running totals for watching a machine from outside while it runs, see Chip::set_metrics. The thread running the
+    //machine is the only writer and updates them once per frame with plain loads and stores (no locked instructions);
+    //the block has its cache lines to itself, so a MetricsPublisher reading them from another thread rarely contends with
+    //it: each read only shares the lines, and the writer's next store takes them back
+    struct alignas(64) Metrics{
+        Metrics();
+        
+        //for the single writer only
+        static void add(std::atomic<uint64_t>& counter, uint64_t amount){
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+        
+        std::atomic<uint64_t> instructions;
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> presented; //frames passed to update_display
+        std::atomic<uint64_t> dropped; //of those, replaced before the frontend could show them (Frontend::dropped_frames)
+        //host time by what it went to, in nanoseconds: running instructions (with the timers and rewind snapshots),
+        //Frontend::update_display, Frontend::update_keys, and waiting for the next frame's deadline
+        std::atomic<uint64_t> interpret_ns;
+        std::atomic<uint64_t> display_ns;
+        std::atomic<uint64_t> keys_ns;
+        std::atomic<uint64_t> sleep_ns;
+        //how late paced frames woke up past their deadline, summed over paced_frames
+        std::atomic<uint64_t> overshoot_ns;
+        std::atomic<uint64_t> paced_frames;
+        //how far after the end of its frame's time slot the last timer tick came, 0 while the machine keeps up
+        std::atomic<uint64_t> timer_lag_ns;
+    };
+    
+    //one interval of a Metrics block, as rates and shares
+    struct MetricsSample{
+        double time; //seconds since the publisher started, at the end of the interval
+        double instructions_per_second;
+        double frames_per_second;
+        double presented_per_second;
+        uint64_t dropped; //frames dropped during the interval
+        //shares of the interval's wall clock time, 0 to 1; whatever is left went elsewhere
+        double interpret;
+        double display;
+        double keys;
+        double sleep;
+        double overshoot_us; //mean over the interval's paced frames
+        double timer_lag_us;
+        
+        //one line of space separated key=value pairs, without the newline
+        std::string format() const;
+    };
+    
+    //samples a Metrics block every interval on a thread of its own and writes each sample as a line, to a file or as a
+    //datagram to a UNIX socket, and hands it to a listener (the SDL overlay). Nothing is ever waited for: a socket
+    //nobody reads from just loses the lines
+    class MetricsPublisher{
+    
+    public:
+        MetricsPublisher(const Metrics& metrics, double interval_seconds);
+        ~MetricsPublisher();
+        
+        //a file path, or unix:PATH for a datagram socket bound at PATH; false with a reason if it cannot be used
+        bool open(std::string destination, std::string& error);
+        //called on the publishing thread with every sample
+        void set_listener(std::function<void(const MetricsSample&)> listener){ this->listener = listener; }
+        
+        void start();
+        void stop();
+    
+    private:
+        const Metrics& metrics;
+        double interval_seconds;
+        std::function<void(const MetricsSample&)> listener;
+        
+        std::ofstream file;
+        int socket_fd;
+        std::string socket_path;
+        
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool running;
+        
+        void publish();
+        void write(const std::string& line);
+    };
+}
+
+#endif
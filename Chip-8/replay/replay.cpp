@@ -0,0 +1,146 @@
+#include "replay.hpp"
+#include "hash.hpp"
+#include<fstream>
+#include<cstring>
+
+namespace chip{
+    namespace{
+        const char recording_magic[8] = {'C', 'H', '8', 'I', 'N', 'P', 'U', 'T'};
+        
+        void put(std::vector<unsigned char>& out, unsigned long long value, int bytes){
+            for(int i = 0; i < bytes; i++){
+                out.push_back((value >> (8 * i)) & 0xFF);
+            }
+        }
+        
+        void put_varint(std::vector<unsigned char>& out, unsigned long long value){
+            while(value >= 0x80){
+                out.push_back((value & 0x7F) | 0x80);
+                value >>= 7;
+            }
+            out.push_back(value);
+        }
+        
+        //reads from data[position], false once it would run past the end
+        bool get(const std::vector<unsigned char>& data, size_t& position, unsigned long long& value, int bytes){
+            if(position + bytes > data.size()){
+                return false;
+            }
+            value = 0;
+            for(int i = 0; i < bytes; i++){
+                value |= (unsigned long long)data[position++] << (8 * i);
+            }
+            return true;
+        }
+        
+        bool get_varint(const std::vector<unsigned char>& data, size_t& position, unsigned long long& value){
+            value = 0;
+            for(int shift = 0; shift < 64; shift += 7){
+                if(position >= data.size()){
+                    return false;
+                }
+                const unsigned char byte = data[position++];
+                value |= (unsigned long long)(byte & 0x7F) << shift;
+                if(!(byte & 0x80)){
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+    
+    Recording::Recording(){
+        seed = Chip::default_seed;
+        clock_hertz = Chip::default_clock_hertz;
+        rom_hash = 0;
+        cycles = 0;
+        final_hash = 0;
+    }
+    
+    bool Recording::save(std::string path) const {
+        std::vector<unsigned char> out(recording_magic, recording_magic + sizeof(recording_magic));
+        put(out, seed, 4);
+        put(out, clock_hertz, 4);
+        put(out, rom_hash, 8);
+        put(out, cycles, 8);
+        put(out, final_hash, 8);
+        put(out, input.size(), 4);
+        
+        unsigned long previous = 0;
+        for(size_t i = 0; i < input.size(); i++){
+            put_varint(out, input[i].cycle - previous);
+            put(out, input[i].keys, 2);
+            previous = input[i].cycle;
+        }
+        
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(out.data()), out.size());
+        return file.good();
+    }
+    
+    bool Recording::load(std::string path){
+        std::ifstream file(path, std::ios::binary);
+        if(!file){
+            return false;
+        }
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(data.size() < sizeof(recording_magic) || memcmp(data.data(), recording_magic, sizeof(recording_magic)) != 0){
+            return false;
+        }
+        
+        size_t position = sizeof(recording_magic);
+        unsigned long long value[6];
+        const int sizes[6] = {4, 4, 8, 8, 8, 4};
+        for(int i = 0; i < 6; i++){
+            if(!get(data, position, value[i], sizes[i])){
+                return false;
+            }
+        }
+        seed = value[0];
+        clock_hertz = value[1];
+        rom_hash = value[2];
+        cycles = value[3];
+        final_hash = value[4];
+        
+        input.clear();
+        unsigned long cycle = 0;
+        for(unsigned long long i = 0; i < value[5]; i++){
+            unsigned long long delta, keys;
+            if(!get_varint(data, position, delta) || !get(data, position, keys, 2)){
+                return false;
+            }
+            cycle += delta;
+            input.push_back({cycle, static_cast<unsigned short>(keys)});
+        }
+        return true;
+    }
+    
+    unsigned long long hash_machine(const Chip& chip){
+        MachineState state;
+        chip.save_state(state);
+        //the held keys are input, not state
+        memset(state.keys, 0, sizeof(state.keys));
+        return hash_bytes(&state, sizeof(state));
+    }
+    
+    RecordingFrontend::RecordingFrontend(Frontend& inner, Recording& recording) : inner(inner), recording(recording){
+        last_keys = 0;
+    }
+    
+    bool RecordingFrontend::init(){
+        recording.input.clear();
+        last_keys = 0;
+        return inner.init();
+    }
+    
+    bool RecordingFrontend::update_keys(KeyMask& keys, unsigned long cycle){
+        const bool running = inner.update_keys(keys, cycle);
+        
+        const unsigned short mask = keys.load(std::memory_order_relaxed);
+        if(running && mask != last_keys){
+            recording.input.push_back({cycle, mask});
+            last_keys = mask;
+        }
+        return running;
+    }
+}
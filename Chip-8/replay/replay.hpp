@@ -0,0 +1,57 @@
+#ifndef REPLAY_HPP
+#define REPLAY_HPP
+
+#include "chip.hpp"
+#include "headless_frontend.hpp"
+#include<vector>
+#include<string>
+
+namespace chip{
+    //everything needed to run a session again exactly: the seed, the clock, every key change by cycle, and hashes
+    //of the ROM and of the final machine state to check the result against
+    struct Recording{
+        unsigned int seed;
+        int clock_hertz;
+        unsigned long long rom_hash;
+        unsigned long cycles; //total instructions executed
+        unsigned long long final_hash; //hash_machine at the end of the run
+        std::vector<InputEvent> input;
+        
+        Recording();
+        
+        //little endian header, then each event as the varint cycle distance from the previous one and the 16 bit mask
+        bool save(std::string path) const;
+        bool load(std::string path);
+    };
+    
+    //hash of the full machine state (memory, registers, stack, timers, screen)
+    unsigned long long hash_machine(const Chip& chip);
+    
+    //passes everything through to another frontend, and logs every change of the key state with its cycle
+    class RecordingFrontend : public Frontend{
+    
+    public:
+        RecordingFrontend(Frontend& inner, Recording& recording);
+        
+        bool init() override;
+        void clean_up() override { inner.clean_up(); }
+        
+        bool update_keys(KeyMask& keys, unsigned long cycle) override;
+        void update_display(const Framebuffer& display) override { inner.update_display(display); }
+        void update_sound(bool on) override { inner.update_sound(on); }
+        
+        //rewinding would make the log disagree with the machine, so it is not passed through
+        bool rewinding() const override { return false; }
+        bool fast_forward() const override { return inner.fast_forward(); }
+        bool throttled() const override { return inner.throttled(); }
+        unsigned long cycle_limit() const override { return inner.cycle_limit(); }
+        std::string quit_message() const override { return inner.quit_message(); }
+    
+    private:
+        Frontend& inner;
+        Recording& recording;
+        unsigned short last_keys;
+    };
+}
+
+#endif
@@ -0,0 +1,526 @@
+#include "chip.hpp"
+#include "headless_frontend.hpp"
+#include "replay.hpp"
+#include "trace.hpp"
+#include "profile.hpp"
+#include "debugger.hpp"
+#include "batch.hpp"
+#include "lockstep.hpp"
+#include "rewind.hpp"
+#include "chip8.h"
+#include "roms.hpp"
+#include<iostream>
+#include<sstream>
+#include<filesystem>
+#include<vector>
+#include<string>
+#include<cstring>
+#include<cstdio>
+
+//Every way of running a machine has to end exactly where the plain interpreter ends. The reference (stepped) runs one
+//instruction at a time and never fuses a pair or skips an idle loop; each case runs the bench's synthetic ROMs and a few
+//seeded random ones, at a game clock and at a clock where every frame is a long burst, under every quirk profile, and
+//compares the cycle count and hash_machine (or the JobResults, for batches) with it.
+//Usage: chip8-equivalence-test CASE, one of the names in main. Exits non-zero on the first mismatch, for ctest; the JIT
+//case exits with 77 (skipped) on hosts without one.
+
+namespace{
+    struct Program{
+        std::string name;
+        std::vector<unsigned char> rom;
+        int clock_hertz;
+        unsigned long frames;
+        std::vector<chip::InputEvent> input;
+    };
+    
+    struct Outcome{
+        unsigned long cycles;
+        unsigned long long hash;
+        unsigned char v[16];
+        unsigned short I;
+        uint64_t top_row;
+        unsigned long fused_pairs;
+        unsigned long idle_cycles;
+    };
+    
+    Outcome outcome(const chip::Chip& chip){
+        Outcome o;
+        o.cycles = chip.get_cycle_count();
+        o.hash = chip::hash_machine(chip);
+        memcpy(o.v, chip.get_registers(), sizeof(o.v));
+        o.I = chip.get_I();
+        o.top_row = chip.get_display().rows[0];
+        o.fused_pairs = chip.get_frame_stats().fused_pairs;
+        o.idle_cycles = chip.get_frame_stats().idle_cycles;
+        return o;
+    }
+    
+    //valid opcodes only. Jumps land on the ROM's own instructions, every call goes to one subroutine at the end so the
+    //stack never overflows, and I points into the ROM or the page after it so that stores rewrite cached code
+    std::vector<unsigned char> random_rom(unsigned int seed){
+        unsigned int state = seed;
+        const int length = 96;
+        const unsigned short subroutine = 0x200 + 2 * length;
+        const unsigned short alu[9] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+        const unsigned short misc[8] = {0x07, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+        
+        std::vector<unsigned short> words;
+        for(int i = 0; i < length; i++){
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            const unsigned int r = state;
+            const unsigned short x = (r >> 8) & 0xF;
+            const unsigned short y = (r >> 12) & 0xF;
+            const unsigned short kk = (r >> 16) & 0xFF;
+            const unsigned short target = 0x200 + 2 * ((r >> 20) % length);
+            switch(r % 40){
+                case 0: words.push_back(0x00E0); break;
+                case 1: case 2: words.push_back(0x1000 | target); break;
+                case 3: case 4: words.push_back(0x2000 | subroutine); break;
+                case 5: case 6: words.push_back(0x3000 | x << 8 | kk); break;
+                case 7: case 8: words.push_back(0x4000 | x << 8 | kk); break;
+                case 9: words.push_back(0x5000 | x << 8 | y << 4); break;
+                case 10: case 11: case 12: case 13: words.push_back(0x6000 | x << 8 | kk); break;
+                case 14: case 15: case 16: words.push_back(0x7000 | x << 8 | kk); break;
+                case 17: case 18: case 19: case 20: case 21: words.push_back(0x8000 | x << 8 | y << 4 | alu[(r >> 24) % 9]); break;
+                case 22: words.push_back(0x9000 | x << 8 | y << 4); break;
+                case 23: case 24: words.push_back(0xA000 | (0x200 + (r >> 20) % 0x200)); break;
+                case 25: words.push_back(0xB000 | target); break;
+                case 26: case 27: words.push_back(0xC000 | x << 8 | kk); break;
+                case 28: case 29: words.push_back(0xD000 | x << 8 | y << 4 | (1 + (r >> 24) % 15)); break;
+                case 30: words.push_back(0xE000 | x << 8 | ((r >> 24) & 1 ? 0x9E : 0xA1)); break;
+                case 31: words.push_back(0xF00A | x << 8); break;
+                default: words.push_back(0xF000 | x << 8 | misc[(r >> 24) % 8]); break;
+            }
+        }
+        words.push_back(0x8014);
+        words.push_back(0x7101);
+        words.push_back(0x00EE);
+        return bench::to_bytes(words);
+    }
+    
+    //a different set of held keys every couple of frames
+    std::vector<chip::InputEvent> key_changes(int clock_hertz, unsigned long frames, unsigned int seed){
+        std::vector<chip::InputEvent> input;
+        const unsigned long every = 2 * clock_hertz / 60 + seed % 7;
+        for(unsigned long cycle = every, i = seed; cycle < frames * clock_hertz / 60; cycle += every, i++){
+            input.push_back({cycle, (unsigned short)(1 << (i * 5 % 16) | 1 << (i * 3 % 16))});
+        }
+        return input;
+    }
+    
+    std::vector<Program> programs(){
+        const std::vector<std::pair<std::string, std::vector<unsigned char> > > roms = {
+            {"alu", bench::alu_rom()}, {"draw", bench::draw_rom()}, {"memory", bench::memory_rom()},
+            {"branch", bench::branch_rom()}, {"game", bench::game_rom()}, {"busy", bench::busy_rom()},
+            {"score", bench::score_rom()}, {"random1", random_rom(1)}, {"random2", random_rom(0x2545F491)},
+            {"random3", random_rom(77)}, {"random4", random_rom(0xC0FFEE)}
+        };
+        const int game_hertz = 500;
+        const int burst_hertz = 60 * 10000;
+        std::vector<Program> list;
+        for(size_t i = 0; i < roms.size(); i++){
+            list.push_back({roms[i].first + "@500", roms[i].second, game_hertz, 300, key_changes(game_hertz, 300, i)});
+            list.push_back({roms[i].first + "@burst", roms[i].second, burst_hertz, 12, key_changes(burst_hertz, 12, i)});
+        }
+        return list;
+    }
+    
+    const chip::QuirkProfile profiles[chip::QUIRKS_COUNT] = {chip::QUIRKS_CHIP8, chip::QUIRKS_VIP, chip::QUIRKS_SCHIP, chip::QUIRKS_XOCHIP};
+    
+    //keys change between frames, from the first frame boundary at or after each event's cycle, as HeadlessFrontend does it
+    void apply_input(chip::Chip& chip, const std::vector<chip::InputEvent>& input, size_t& next){
+        while(next < input.size() && input[next].cycle <= chip.get_cycle_count()){
+            chip.set_keys(input[next].keys);
+            next++;
+        }
+    }
+    
+    //one instruction at a time with a breakpoint on every other address: a pair never fuses across a breakpoint, so
+    //each instruction runs through its own handler, and a burst of one never reaches an idle loop
+    Outcome stepped(const Program& p, chip::QuirkProfile quirks){
+        chip::Chip chip(p.clock_hertz);
+        chip.set_quirks(quirks);
+        chip.load(p.rom.data(), p.rom.size());
+        for(unsigned short address = 0; address < 4096; address++){
+            chip.set_breakpoint(address, true);
+        }
+        size_t next = 0;
+        apply_input(chip, p.input, next);
+        while(chip.get_frames() < p.frames){
+            const unsigned long frames = chip.get_frames();
+            const unsigned short pc = chip.get_pc();
+            chip.set_breakpoint(pc, false);
+            const int stopped = chip.run_frame(1);
+            chip.set_breakpoint(pc, true);
+            if(stopped != -1){
+                break;
+            }
+            if(chip.get_frames() != frames){
+                apply_input(chip, p.input, next);
+            }
+        }
+        return outcome(chip);
+    }
+    
+    //whole frames from a host loop
+    Outcome hosted(const Program& p, chip::QuirkProfile quirks){
+        chip::Chip chip(p.clock_hertz);
+        chip.set_quirks(quirks);
+        chip.load(p.rom.data(), p.rom.size());
+        size_t next = 0;
+        for(unsigned long frame = 0; frame < p.frames; frame++){
+            apply_input(chip, p.input, next);
+            if(chip.run_frame() != -1){
+                break;
+            }
+        }
+        return outcome(chip);
+    }
+    
+    //Chip::run on a headless frontend, with whatever is attached
+    Outcome run(const Program& p, chip::QuirkProfile quirks, bool jit, chip::Tracer* tracer, chip::Profiler* profiler){
+        chip::HeadlessFrontend frontend(p.frames, 0);
+        frontend.set_input(&p.input);
+        chip::Chip chip(p.clock_hertz, frontend);
+        chip.set_quirks(quirks);
+        if(jit){
+            chip.enable_jit();
+        }
+        chip.set_tracer(tracer);
+        chip.set_profiler(profiler);
+        chip.run(p.rom.data(), p.rom.size());
+        return outcome(chip);
+    }
+    
+    Outcome interpreted(const Program& p, chip::QuirkProfile quirks){
+        return run(p, quirks, false, nullptr, nullptr);
+    }
+    
+    Outcome jitted(const Program& p, chip::QuirkProfile quirks){
+        return run(p, quirks, true, nullptr, nullptr);
+    }
+    
+    Outcome traced(const Program& p, chip::QuirkProfile quirks){
+        const std::string path = (std::filesystem::temp_directory_path() / "chip8-equivalence.trace").string();
+        chip::Tracer tracer;
+        if(!tracer.open(path)){
+            std::cout << "trace file could not be opened: " << path << std::endl;
+            std::exit(1);
+        }
+        const Outcome o = run(p, quirks, false, &tracer, nullptr);
+        tracer.close();
+        std::remove(path.c_str());
+        return o;
+    }
+    
+    Outcome profiled(const Program& p, chip::QuirkProfile quirks){
+        chip::Profiler profiler;
+        return run(p, quirks, false, nullptr, &profiler);
+    }
+    
+    //a Debugger with breakpoints on every fifth instruction of the ROM and a watchpoint over the page after it,
+    //resumed a frame at a time until the frame is done
+    Outcome debugged(const Program& p, chip::QuirkProfile quirks){
+        chip::Chip chip(p.clock_hertz);
+        chip.set_quirks(quirks);
+        chip.load(p.rom.data(), p.rom.size());
+        chip::Debugger debugger(chip);
+        std::ostringstream ignored;
+        for(size_t address = 0x200; address < 0x200 + p.rom.size(); address += 10){
+            std::ostringstream command;
+            command << "break " << std::hex << address;
+            debugger.command(command.str(), ignored);
+        }
+        debugger.command("watch 300 100", ignored);
+        
+        size_t next = 0;
+        bool stopped = false;
+        for(unsigned long frame = 0; frame < p.frames && !stopped; frame++){
+            apply_input(chip, p.input, next);
+            while(chip.get_frames() == frame){
+                if(debugger.resume(0, 1) == chip::Debugger::STOP_INVALID_OPCODE){
+                    stopped = true;
+                    break;
+                }
+            }
+        }
+        return outcome(chip);
+    }
+    
+    typedef Outcome (*Path)(const Program&, chip::QuirkProfile);
+    
+    //every program under every profile down path against the stepped reference; counts what the path fused and skipped
+    bool matches_reference(const char* name, Path path, Outcome& totals){
+        totals = Outcome();
+        for(const Program& p : programs()){
+            for(chip::QuirkProfile quirks : profiles){
+                const Outcome expected = stepped(p, quirks);
+                const Outcome actual = path(p, quirks);
+                if(actual.cycles != expected.cycles || actual.hash != expected.hash){
+                    std::cout << name << " diverged on " << p.name << " with " << chip::quirks_name(quirks) << " quirks: "
+                        << actual.cycles << " cycles against " << expected.cycles << std::endl;
+                    return false;
+                }
+                totals.fused_pairs += actual.fused_pairs;
+                totals.idle_cycles += actual.idle_cycles;
+            }
+        }
+        std::cout << name << " matches the stepped interpreter (" << totals.fused_pairs << " fused pairs, "
+            << totals.idle_cycles << " idle cycles skipped)" << std::endl;
+        return true;
+    }
+    
+    //the fused handlers and idle loop skipping must actually have run, or the comparison proves nothing about them
+    int check_fast_paths(){
+        Outcome totals;
+        if(!matches_reference("run", interpreted, totals)){
+            return 1;
+        }
+        if(totals.fused_pairs == 0 || totals.idle_cycles == 0){
+            std::cout << "the programs no longer exercise fused pairs and idle loop skipping" << std::endl;
+            return 1;
+        }
+        return matches_reference("run_frame", hosted, totals) ? 0 : 1;
+    }
+    
+    //each profile's policy flags against a ROM whose end state shows all four:
+    //vA is 1 after a BxNN jump (jump_vx) and 2 after Bnnn, v0 is 6 after 8xy6 shifted Vy and 2 after it shifted Vx,
+    //I is 0x302 after Fx55 moved it and 0x300 otherwise, and the pixel at 0,0 is lit only if the sprite drawn at
+    //x = 62 wrapped around instead of being clipped
+    int check_quirks(){
+        const std::vector<unsigned char> rom = bench::to_bytes({
+            0x603E, 0x6100, 0x6200, 0xF229, 0xD011,
+            0x6008, 0x6204, 0xB210, 0x0000, 0x0000, //0x20A
+            0x6A01, 0x121A, //0x214
+            0x6A02, //0x218
+            0x6005, 0x610C, 0x8016, 0xA300, 0xF155, //0x21A
+            0x1224 //0x224
+        });
+        struct Flags{
+            bool shift_vy;
+            bool load_store_i;
+            bool clip_sprites;
+            bool jump_vx;
+        };
+        const Flags flags[chip::QUIRKS_COUNT] = {
+            {chip::QuirksChip8::shift_vy, chip::QuirksChip8::load_store_i, chip::QuirksChip8::clip_sprites, chip::QuirksChip8::jump_vx},
+            {chip::QuirksVip::shift_vy, chip::QuirksVip::load_store_i, chip::QuirksVip::clip_sprites, chip::QuirksVip::jump_vx},
+            {chip::QuirksSchip::shift_vy, chip::QuirksSchip::load_store_i, chip::QuirksSchip::clip_sprites, chip::QuirksSchip::jump_vx},
+            {chip::QuirksXochip::shift_vy, chip::QuirksXochip::load_store_i, chip::QuirksXochip::clip_sprites, chip::QuirksXochip::jump_vx}
+        };
+        const Program p = {"quirks", rom, 500, 4, {}};
+        const Path paths[] = {stepped, hosted, interpreted, jitted, traced, profiled, debugged};
+        for(chip::QuirkProfile quirks : profiles){
+            const Flags& f = flags[quirks];
+            for(Path path : paths){
+                const Outcome o = path(p, quirks);
+                if(o.v[0xA] != (f.jump_vx ? 1 : 2) || o.v[0] != (f.shift_vy ? 6 : 2) || o.I != (f.load_store_i ? 0x302 : 0x300)
+                    || ((o.top_row >> 63) & 1) != (f.clip_sprites ? 0u : 1u)){
+                    std::cout << chip::quirks_name(quirks) << " quirks not honoured: vA " << (int)o.v[0xA] << ", v0 " << (int)o.v[0]
+                        << ", I " << std::hex << o.I << std::dec << ", top row " << std::hex << o.top_row << std::dec << std::endl;
+                    return 1;
+                }
+            }
+        }
+        std::cout << "every path honours every quirk profile" << std::endl;
+        return 0;
+    }
+    
+    bool same_results(const std::vector<chip::JobResult>& a, const std::vector<chip::JobResult>& b){
+        if(a.size() != b.size()){
+            return false;
+        }
+        for(size_t i = 0; i < a.size(); i++){
+            if(a[i].exit_reason != b[i].exit_reason || a[i].display_hash != b[i].display_hash || memcmp(a[i].v, b[i].v, sizeof(a[i].v)) != 0
+                || a[i].I != b[i].I || a[i].pc != b[i].pc || a[i].cycles != b[i].cycles){
+                std::cout << "job " << i << " ended at pc " << std::hex << a[i].pc << " and " << b[i].pc << std::dec
+                    << " after " << a[i].cycles << " and " << b[i].cycles << " cycles" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    //a batch of jobs per program with different seeds, keys and budgets: one machine per job, the same with the JIT,
+    //and the SIMD lockstep interpreter must all give the same results
+    int check_lockstep(){
+        for(const Program& p : programs()){
+            for(chip::QuirkProfile quirks : profiles){
+                std::shared_ptr<unsigned char> rom(new unsigned char[p.rom.size()], std::default_delete<unsigned char[]>());
+                memcpy(rom.get(), p.rom.data(), p.rom.size());
+                std::vector<chip::Job> jobs;
+                for(unsigned int i = 0; i < 40; i++){
+                    chip::Job job;
+                    job.rom = rom;
+                    job.rom_size = p.rom.size();
+                    job.input = key_changes(p.clock_hertz, p.frames, i);
+                    job.cycles = p.frames * p.clock_hertz / 60 - i * 37;
+                    job.seed = 1 + i;
+                    job.quirks = quirks;
+                    jobs.push_back(job);
+                }
+                
+                chip::BatchRunner batch(1, p.clock_hertz);
+                const std::vector<chip::JobResult> plain = batch.run(jobs, false);
+                const std::vector<chip::JobResult> jit = batch.run(jobs, true);
+                //40 jobs over two chunks of lanes
+                batch.set_lockstep(2 * chip::Lockstep::chunk_lanes);
+                const std::vector<chip::JobResult> lockstep = batch.run(jobs, false);
+                if(!same_results(plain, jit) || !same_results(plain, lockstep)){
+                    std::cout << "batch runs diverged on " << p.name << " with " << chip::quirks_name(quirks) << " quirks" << std::endl;
+                    return 1;
+                }
+            }
+        }
+        std::cout << "lockstep and JIT batches match one machine per job" << std::endl;
+        return 0;
+    }
+    
+    //every frame's state goes into a Rewind; stepping back has to give each of them back byte for byte, and a machine
+    //restored from one of them has to end where the original did
+    int check_rewind(){
+        for(const Program& p : programs()){
+            chip::Chip chip(p.clock_hertz);
+            chip.load(p.rom.data(), p.rom.size());
+            chip::Rewind rewind(64 << 20);
+            std::vector<chip::MachineState> history;
+            std::vector<size_t> inputs_applied;
+            size_t next = 0;
+            for(unsigned long frame = 0; frame < p.frames; frame++){
+                apply_input(chip, p.input, next);
+                history.push_back(chip::MachineState());
+                chip.save_state(history.back());
+                inputs_applied.push_back(next);
+                rewind.push(history.back());
+                if(chip.run_frame() != -1){
+                    break;
+                }
+            }
+            const unsigned long long final_hash = chip::hash_machine(chip);
+            const unsigned long final_frames = chip.get_frames();
+            
+            chip::MachineState state = history.back();
+            for(size_t i = history.size() - 1; i-- > 0; ){
+                if(!rewind.step_back(state) || memcmp(&state, &history[i], sizeof(state)) != 0){
+                    std::cout << "rewinding " << p.name << " did not give back frame " << i << std::endl;
+                    return 1;
+                }
+            }
+            
+            const size_t resume = history.size() / 2;
+            chip::Chip restored(p.clock_hertz);
+            restored.load(p.rom.data(), p.rom.size());
+            restored.load_state(history[resume]);
+            next = inputs_applied[resume];
+            for(unsigned long frame = resume; frame < final_frames; frame++){
+                if(frame != resume){
+                    apply_input(restored, p.input, next);
+                }
+                if(restored.run_frame() != -1){
+                    break;
+                }
+            }
+            if(chip::hash_machine(restored) != final_hash){
+                std::cout << p.name << " restored at frame " << resume << " did not end where the original did" << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "rewind gives back every state, and restored machines carry on identically" << std::endl;
+        return 0;
+    }
+    
+    //the C interface against the C++ machine it wraps, frame by frame with the same keys
+    int check_c_abi(){
+        chip8_machine* empty = chip8_create(0);
+        if(empty == nullptr || chip8_step(empty, 10) != 0x200 || chip8_set_quirks(empty, "nonsense") != 0 || chip8_set_quirks(empty, nullptr) != 0){
+            std::cout << "a machine before its first load does not behave as chip8.h says" << std::endl;
+            return 1;
+        }
+        chip8_destroy(empty);
+        
+        for(const Program& p : programs()){
+            for(chip::QuirkProfile quirks : profiles){
+                for(int jit = 0; jit < 2; jit++){
+                    chip8_machine* machine = chip8_create(p.clock_hertz);
+                    chip::Chip chip(p.clock_hertz);
+                    chip.set_quirks(quirks);
+                    if(machine == nullptr || chip8_set_quirks(machine, chip::quirks_name(quirks)) != 1){
+                        std::cout << "machine could not be created with " << chip::quirks_name(quirks) << " quirks" << std::endl;
+                        return 1;
+                    }
+                    if(jit && chip8_enable_jit(machine) == 1){
+                        chip.enable_jit();
+                    }
+                    chip8_load(machine, p.rom.data(), p.rom.size());
+                    chip.load(p.rom.data(), p.rom.size());
+                    
+                    size_t next = 0;
+                    bool same = true;
+                    for(unsigned long frame = 0; frame < p.frames && same; frame++){
+                        apply_input(chip, p.input, next);
+                        chip8_set_keys(machine, next != 0 ? p.input[next - 1].keys : 0);
+                        const int expected = chip.run_frame();
+                        same = chip8_run_frame(machine) == expected && chip8_cycles(machine) == chip.get_cycle_count()
+                            && chip8_pc(machine) == chip.get_pc() && chip8_i(machine) == chip.get_I()
+                            && memcmp(chip8_registers(machine), chip.get_registers(), 16) == 0
+                            && memcmp(chip8_memory(machine), chip.get_memory(), 4096) == 0
+                            && memcmp(chip8_display(machine), chip.get_display().rows, sizeof(chip.get_display().rows)) == 0
+                            && chip8_sound(machine) == (chip.get_sound() ? 1 : 0);
+                        if(expected != -1){
+                            break;
+                        }
+                    }
+                    chip8_destroy(machine);
+                    if(!same){
+                        std::cout << "the C interface diverged on " << p.name << " with " << chip::quirks_name(quirks) << " quirks"
+                            << (jit ? " and the JIT" : "") << std::endl;
+                        return 1;
+                    }
+                }
+            }
+        }
+        std::cout << "the C interface matches the machine it wraps" << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const std::string name = argc > 1 ? argv[1] : "";
+    Outcome totals;
+    if(name == "fast_paths"){
+        return check_fast_paths();
+    }
+    if(name == "jit"){
+        chip::Chip probe(chip::Chip::default_clock_hertz);
+        if(!probe.enable_jit()){
+            std::cout << "no JIT on this host" << std::endl;
+            return 77;
+        }
+        return matches_reference("jit", jitted, totals) ? 0 : 1;
+    }
+    if(name == "trace"){
+        return matches_reference("trace", traced, totals) ? 0 : 1;
+    }
+    if(name == "profile"){
+        return matches_reference("profile", profiled, totals) ? 0 : 1;
+    }
+    if(name == "debugger"){
+        return matches_reference("debugger", debugged, totals) ? 0 : 1;
+    }
+    if(name == "quirks"){
+        return check_quirks();
+    }
+    if(name == "lockstep"){
+        return check_lockstep();
+    }
+    if(name == "rewind"){
+        return check_rewind();
+    }
+    if(name == "c_abi"){
+        return check_c_abi();
+    }
+    std::cout << "Usage: chip8-equivalence-test fast_paths|jit|trace|profile|debugger|quirks|lockstep|rewind|c_abi" << std::endl;
+    return 1;
+}
@@ -0,0 +1,53 @@
+#include "chip.hpp"
+#include "headless_frontend.hpp"
+#include "replay.hpp"
+#include<iostream>
+#include<vector>
+#include<cstring>
+#include<new>
+
+//A fork taken from a running machine and continued on a freshly constructed one has to end exactly where the
+//original ends. The fresh machine is built in storage filled with the same byte the ROM's loop is made of, so a
+//machine that trusted its unset memory would keep whatever its unset decode cache says for that loop.
+//Exits non-zero on a mismatch, for ctest.
+
+namespace{
+    const unsigned char fill = 0x12;
+    
+    //v0 = 5, then jumps: 0x202 to 0x212, which jumps to itself forever
+    std::vector<unsigned char> loop_rom(){
+        std::vector<unsigned char> rom = {0x60, 0x05};
+        while(rom.size() < 0x18){
+            rom.push_back(fill);
+        }
+        return rom;
+    }
+    
+    alignas(chip::Chip) unsigned char storage[sizeof(chip::Chip)];
+}
+
+int main() {
+    const std::vector<unsigned char> rom = loop_rom();
+    const unsigned long frames = 120;
+    
+    chip::HeadlessFrontend frontend(frames, 0);
+    chip::Chip original(chip::Chip::default_clock_hertz, frontend);
+    original.run(rom.data(), rom.size());
+    chip::Fork fork;
+    original.save_fork(fork);
+    original.run(fork);
+    
+    memset(storage, fill, sizeof(storage));
+    chip::HeadlessFrontend fresh_frontend(frames, 0);
+    chip::Chip* fresh = new(storage) chip::Chip(chip::Chip::default_clock_hertz, fresh_frontend);
+    fresh->run(fork);
+    const bool same = fresh->get_cycle_count() == original.get_cycle_count() && chip::hash_machine(*fresh) == chip::hash_machine(original);
+    fresh->~Chip();
+    
+    if(!same){
+        std::cout << "fork continued on a fresh machine diverged from the original" << std::endl;
+        return 1;
+    }
+    std::cout << "fork continued on a fresh machine matches the original" << std::endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "trace.hpp"
+#include "chip.hpp"
+#include<chrono>
+#include<cstring>
+#include<iomanip>
+
+namespace chip{
+    namespace{
+        const char trace_magic[8] = {'C', 'H', '8', 'T', 'R', 'A', 'C', 'E'};
+        const uint32_t trace_version = 1;
+    }
+    
+    Tracer::Tracer(size_t capacity) : write_index(0), read_index(0), stalls(0), running(false){
+        size_t size = 1;
+        while(size < capacity){
+            size <<= 1;
+        }
+        buffer.resize(size);
+        mask = size - 1;
+    }
+    
+    Tracer::~Tracer(){
+        close();
+    }
+    
+    bool Tracer::open(std::string path){
+        close();
+        
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if(!file){
+            return false;
+        }
+        
+        const uint32_t record_size = sizeof(TraceRecord);
+        file.write(trace_magic, sizeof(trace_magic));
+        file.write(reinterpret_cast<const char*>(&trace_version), sizeof(trace_version));
+        file.write(reinterpret_cast<const char*>(&record_size), sizeof(record_size));
+        
+        write_index.store(0);
+        read_index.store(0);
+        stalls.store(0);
+        running.store(true);
+        writer = std::thread(&Tracer::drain, this);
+        return true;
+    }
+    
+    void Tracer::close(){
+        if(writer.joinable()){
+            running.store(false, std::memory_order_release);
+            writer.join();
+        }
+        if(file.is_open()){
+            file.close();
+        }
+    }
+    
+    //the background thread: writes whatever is in the buffer, in at most two pieces where it wraps around
+    void Tracer::drain(){
+        while(true){
+            const bool stopping = !running.load(std::memory_order_acquire);
+            const uint64_t tail = read_index.load(std::memory_order_relaxed);
+            const uint64_t head = write_index.load(std::memory_order_acquire);
+            
+            if(head == tail){
+                if(stopping){
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            
+            const uint64_t start = tail & mask;
+            const uint64_t count = head - tail;
+            const uint64_t first = count < buffer.size() - start ? count : buffer.size() - start;
+            file.write(reinterpret_cast<const char*>(&buffer[start]), first * sizeof(TraceRecord));
+            file.write(reinterpret_cast<const char*>(&buffer[0]), (count - first) * sizeof(TraceRecord));
+            
+            read_index.store(head, std::memory_order_release);
+        }
+        file.flush();
+    }
+    
+    bool Tracer::decode(std::istream& in, std::ostream& out){
+        char magic[sizeof(trace_magic)];
+        uint32_t version;
+        uint32_t record_size;
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        in.read(reinterpret_cast<char*>(&record_size), sizeof(record_size));
+        if(!in || memcmp(magic, trace_magic, sizeof(magic)) != 0 || version != trace_version || record_size != sizeof(TraceRecord)){
+            return false;
+        }
+        
+        TraceRecord r;
+        while(in.read(reinterpret_cast<char*>(&r), sizeof(r))){
+            out << std::dec << std::setfill(' ') << std::setw(10) << r.cycle << std::hex << std::setfill('0')
+                << "  " << std::setw(3) << r.pc << "  " << std::setw(4) << r.opcode
+                << "  I=" << std::setw(3) << r.I
+                << " Vx=" << std::setw(2) << (int)r.vx
+                << " Vy=" << std::setw(2) << (int)r.vy
+                << "  " << Chip::describe(r.opcode) << '\n';
+        }
+        out << std::dec;
+        return true;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include<atomic>
+#include<thread>
+#include<vector>
+#include<string>
+#include<fstream>
+#include<cstdint>
+
+//set to 0 to compile the tracing hook out of the interpreter entirely
+#ifndef CHIP_TRACE
+#define CHIP_TRACE 1
+#endif
+
+namespace chip{
+    //one executed instruction, as written to the trace file
+    struct TraceRecord{
+        uint64_t cycle;
+        uint16_t pc;
+        uint16_t opcode;
+        uint16_t I;
+        uint8_t vx; //Vx and Vy before the instruction ran
+        uint8_t vy;
+    };
+    static_assert(sizeof(TraceRecord) == 16, "trace files store records as raw 16 byte structs");
+    
+    //collects records from the interpreter thread into a fixed ring buffer, a background thread drains it to a file.
+    //record() never allocates or locks, it only waits if the writer falls a whole buffer behind
+    class Tracer{
+    
+    public:
+        //capacity is rounded up to a power of two
+        Tracer(size_t capacity = 1 << 16);
+        ~Tracer();
+        
+        bool open(std::string path);
+        //waits for every recorded instruction to reach the file
+        void close();
+        
+        void record(const TraceRecord& r){
+            const uint64_t head = write_index.load(std::memory_order_relaxed);
+            while(head - read_index.load(std::memory_order_acquire) > mask){
+                stalls.fetch_add(1, std::memory_order_relaxed);
+                std::this_thread::yield();
+            }
+            buffer[head & mask] = r;
+            write_index.store(head + 1, std::memory_order_release);
+        }
+        
+        //how often record() had to wait for the writer
+        uint64_t get_stalls() const { return stalls.load(std::memory_order_relaxed); }
+        
+        //prints a trace file one instruction per line, with the description of each opcode; false if it is not a trace
+        static bool decode(std::istream& in, std::ostream& out);
+    
+    private:
+        std::vector<TraceRecord> buffer;
+        uint64_t mask;
+        
+        //each on its own cache line, so the interpreter and the writer do not fight over them
+        alignas(64) std::atomic<uint64_t> write_index;
+        alignas(64) std::atomic<uint64_t> read_index;
+        alignas(64) std::atomic<uint64_t> stalls;
+        
+        std::atomic<bool> running;
+        std::thread writer;
+        std::ofstream file;
+        
+        void drain();
+    };
+}
+
+#endif